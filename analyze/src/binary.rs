@@ -0,0 +1,246 @@
+//! This module turns the compact binary results of Baresifter
+//! (`binary=1`) back into its text format.
+
+use std::{error::Error, fmt};
+
+/// The line that precedes binary results.
+const HEADER_LINE: &[u8] = b">>> Binary results follow.\n";
+
+/// The magic that starts binary results after the header line.
+const MAGIC: &[u8] = b"BSR";
+
+/// The version of the binary format we understand.
+const VERSION: u8 = 1;
+
+/// A record with this first byte is followed by a line of text.
+const RECORD_TEXT: u8 = 0x00;
+
+/// A record with this first byte ends the binary results.
+const RECORD_END: u8 = 0x0F;
+
+/// If an instruction record has this exception, the real exception
+/// is in the next byte.
+const EXCEPTION_FOLLOWS: u8 = 0x0F;
+
+#[derive(Debug, PartialEq, Eq)]
+pub enum DecodeError {
+    /// The binary results have a version we don't know.
+    UnsupportedVersion(u8),
+
+    /// The input ends in the middle of binary results.
+    Truncated,
+
+    /// A record starts with this byte, but doesn't make sense.
+    InvalidRecord(u8),
+}
+
+impl Error for DecodeError {}
+
+impl fmt::Display for DecodeError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            DecodeError::UnsupportedVersion(v) => {
+                write!(f, "Unsupported binary format version {}", v)
+            }
+            DecodeError::Truncated => write!(f, "Binary results are truncated"),
+            DecodeError::InvalidRecord(b) => write!(f, "Invalid binary record {:02X}", b),
+        }
+    }
+}
+
+/// A cursor over the input that fails with [DecodeError::Truncated]
+/// when it runs out.
+struct Input<'a> {
+    data: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Input<'a> {
+    fn byte(&mut self) -> Result<u8, DecodeError> {
+        let b = *self.data.get(self.pos).ok_or(DecodeError::Truncated)?;
+        self.pos += 1;
+        Ok(b)
+    }
+
+    fn bytes(&mut self, count: usize) -> Result<&'a [u8], DecodeError> {
+        let end = self.pos.checked_add(count).ok_or(DecodeError::Truncated)?;
+        let s = self.data.get(self.pos..end).ok_or(DecodeError::Truncated)?;
+        self.pos = end;
+        Ok(s)
+    }
+}
+
+/// Find the first header line that starts a line at or after `from`
+/// and return the position after it.
+fn find_header(data: &[u8], from: usize) -> Option<usize> {
+    (from..data.len())
+        .filter(|&i| i == 0 || data[i - 1] == b'\n')
+        .find(|&i| data[i..].starts_with(HEADER_LINE))
+        .map(|i| i + HEADER_LINE.len())
+}
+
+/// Append an instruction in the same text format as Baresifter.
+fn write_instruction(out: &mut Vec<u8>, exception: u8, bytes: &[u8]) {
+    let status = if bytes.len() >= 15 { "??" } else { "OK" };
+
+    out.extend_from_slice(format!("EXC {:02X} {} |", exception, status).as_bytes());
+    for b in bytes {
+        out.extend_from_slice(format!(" {:02X}", b).as_bytes());
+    }
+    out.push(b'\n');
+}
+
+/// Decode binary results until their end record and append them as
+/// text.
+fn decode_results(input: &mut Input, out: &mut Vec<u8>) -> Result<(), DecodeError> {
+    if input.bytes(MAGIC.len())? != MAGIC {
+        return Err(DecodeError::Truncated);
+    }
+
+    let version = input.byte()?;
+    if version != VERSION {
+        return Err(DecodeError::UnsupportedVersion(version));
+    }
+
+    let mut previous = [0u8; 15];
+    let mut previous_len = 0;
+
+    loop {
+        let first = input.byte()?;
+
+        match first {
+            RECORD_TEXT => loop {
+                let c = input.byte()?;
+                out.push(c);
+                if c == b'\n' {
+                    break;
+                }
+            },
+            RECORD_END => return Ok(()),
+            0x01..=0x0E => return Err(DecodeError::InvalidRecord(first)),
+            _ => {
+                let len = usize::from(first >> 4);
+                let exception = match first & 0xF {
+                    EXCEPTION_FOLLOWS => input.byte()?,
+                    e => e,
+                };
+                let shared = usize::from(input.byte()?);
+
+                if shared > len || shared > previous_len {
+                    return Err(DecodeError::InvalidRecord(first));
+                }
+
+                previous[shared..len].copy_from_slice(input.bytes(len - shared)?);
+                previous_len = len;
+
+                write_instruction(out, exception, &previous[..len]);
+            }
+        }
+    }
+}
+
+/// Turn Baresifter output into text. Binary results are decoded and
+/// everything else is passed through as is. So this does nothing to
+/// output that has no binary results.
+pub fn decode(data: &[u8]) -> Result<Vec<u8>, DecodeError> {
+    let mut out = Vec::with_capacity(data.len());
+    let mut input = Input { data, pos: 0 };
+
+    while let Some(header_end) = find_header(data, input.pos) {
+        out.extend_from_slice(&data[input.pos..header_end]);
+        input.pos = header_end;
+
+        decode_results(&mut input, &mut out)?;
+    }
+
+    out.extend_from_slice(&data[input.pos..]);
+    Ok(out)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn passes_text_through() {
+        let text = b">>> Searching from 00.\nEXC 06 OK | 0F 0B\n>>> Done!\n";
+
+        assert_eq!(decode(text), Ok(text.to_vec()));
+    }
+
+    #[test]
+    fn decodes_records() {
+        let mut data = b">>> Start\n>>> Binary results follow.\nBSR\x01".to_vec();
+
+        // EXC 0D OK | 00 04 2E
+        data.extend_from_slice(&[0x3D, 0x00, 0x00, 0x04, 0x2E]);
+        // EXC 13 OK | 00 04 2F, sharing two bytes
+        data.extend_from_slice(&[0x3F, 0x13, 0x02, 0x2F]);
+        data.extend_from_slice(b"\x00CKPT CPU 0 | resume=x\n");
+        data.push(RECORD_END);
+        data.extend_from_slice(b">>> Done!\n");
+
+        let text = b">>> Start\n>>> Binary results follow.\n\
+                     EXC 0D OK | 00 04 2E\n\
+                     EXC 13 OK | 00 04 2F\n\
+                     CKPT CPU 0 | resume=x\n\
+                     >>> Done!\n";
+
+        assert_eq!(decode(&data), Ok(text.to_vec()));
+    }
+
+    #[test]
+    fn decodes_kernel_output() {
+        // Everything before the header is plain text, including the
+        // lines printed while bringing up the other CPUs.
+        let start = b" |             _||       \n\
+                      \x20 _ \\  _|(_-<  _| _|  _| \n\
+                      _.__/_|  ___/_| \\__|_|   \n\
+                      \n64-bit version v1\n\n\
+                      >>> CPU is GenuineIntel 000906EA.\n\
+                      >>> Executing self test.\n\
+                      >>> Searching from 00.\n\
+                      >>> CPU with APIC ID 3 didn't start. Not starting any more CPUs.\n\
+                      >>> Running on 2 CPUs.\n\
+                      >>> Binary results follow.\n";
+
+        let mut data = start.to_vec();
+        data.extend_from_slice(b"BSR\x01");
+        // EXC 06 OK | 06
+        data.extend_from_slice(&[0x16, 0x00, 0x06]);
+        // Text printed by another CPU in the middle of the results.
+        data.extend_from_slice(b"\x00DIFF | 0F 0D | CPU 0 ...\n");
+        // EXC 0E OK | 06 0E, sharing one byte
+        data.extend_from_slice(&[0x2E, 0x01, 0x0E]);
+        data.push(RECORD_END);
+        data.extend_from_slice(b">>> Done!\n");
+
+        let mut text = start.to_vec();
+        text.extend_from_slice(
+            b"EXC 06 OK | 06\n\
+              DIFF | 0F 0D | CPU 0 ...\n\
+              EXC 0E OK | 06 0E\n\
+              >>> Done!\n",
+        );
+
+        assert_eq!(decode(&data), Ok(text));
+    }
+
+    #[test]
+    fn rejects_broken_input() {
+        let header = b">>> Binary results follow.\nBSR";
+
+        assert_eq!(
+            decode(&[&header[..], b"\x02"].concat()),
+            Err(DecodeError::UnsupportedVersion(2))
+        );
+        assert_eq!(
+            decode(&[&header[..], b"\x01\x31\x01\x90"].concat()),
+            Err(DecodeError::InvalidRecord(0x31))
+        );
+        assert_eq!(
+            decode(&[&header[..], b"\x01\x31\x00"].concat()),
+            Err(DecodeError::Truncated)
+        );
+    }
+}
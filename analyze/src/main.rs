@@ -1,12 +1,13 @@
 use anyhow::{anyhow, Context, Result};
 use clap::{crate_version, Clap};
 use std::{
-    fs::File,
-    io::{BufRead, BufReader},
+    fs,
+    io::{self, Write},
     path::PathBuf,
     str::FromStr,
 };
 
+mod binary;
 mod instruction;
 mod parser;
 mod utils;
@@ -21,6 +22,11 @@ struct Opts {
     #[clap(long, default_value = "64")]
     bits: u8,
 
+    /// Only turn binary results (binary=1) into text and print
+    /// everything.
+    #[clap(long)]
+    decode: bool,
+
     /// The input file to parse.
     input_file: PathBuf,
 }
@@ -41,19 +47,31 @@ fn main() -> Result<()> {
     let opts: Opts = Opts::parse();
 
     let decoder = get_decoder(opts.bits)?;
-    let file = File::open(&opts.input_file)
+    let input = fs::read(&opts.input_file)
         .with_context(|| format!("Failed to open input file: {}", opts.input_file.display()))?;
-    let file = BufReader::new(file);
+    let text = binary::decode(&input).context("Failed to decode binary results")?;
+
+    if opts.decode {
+        io::stdout().write_all(&text)?;
+        return Ok(());
+    }
+
+    let mut parsed: Vec<Instruction> = String::from_utf8_lossy(&text)
+        .lines()
+        .filter_map(|l| -> Option<Instruction> { Instruction::from_str(l).ok() })
+        .collect();
+
+    // With multiple CPUs, Baresifter prints the results for different parts
+    // of the instruction space interleaved. Interpolation needs them in search
+    // order.
+    parsed.sort_by_key(|i| *i.all_bytes());
 
-    let instrs = InterpolateAllIterator::new(
-        file.lines()
-            .filter_map(|l| -> Option<Instruction> { Instruction::from_str(&l.ok()?).ok() }),
-    )
-    .map(|i| {
-        let iced_instr = decoder(&i);
-        (i, iced_instr)
-    })
-    .filter(|(i, iced_instr)| i.exception() != 0x06 && i.len() != iced_instr.len());
+    let instrs = InterpolateAllIterator::new(parsed.into_iter())
+        .map(|i| {
+            let iced_instr = decoder(&i);
+            (i, iced_instr)
+        })
+        .filter(|(i, iced_instr)| i.exception() != 0x06 && i.len() != iced_instr.len());
 
     for (bare_instr, iced_instr) in instrs {
         println!(
@@ -15,7 +15,7 @@ let
     patchShebangs $out/bin/baresifter-run
 
     wrapProgram $out/bin/baresifter-run \
-      --prefix PATH : ${pkgs.lib.makeBinPath (with pkgs; [ qemu file binutils-unwrapped ])}
+      --prefix PATH : ${pkgs.lib.makeBinPath (with pkgs; [ qemu file binutils-unwrapped util-linux ])}
   '';
 
   naersk = pkgs.callPackage sources.naersk {};
@@ -0,0 +1,272 @@
+#include <cstring>
+
+#include "acpi.hpp"
+#include "util.hpp"
+
+namespace {
+
+struct rsdp {
+  char signature[8];
+  uint8_t checksum;
+  char oem_id[6];
+  uint8_t revision;
+  uint32_t rsdt_address;
+
+  // Only valid for revision 2 and later.
+  uint32_t length;
+  uint64_t xsdt_address;
+  uint8_t extended_checksum;
+  uint8_t reserved[3];
+} __attribute__((packed));
+
+struct madt {
+  acpi_table_header header;
+  uint32_t lapic_address;
+  uint32_t flags;
+} __attribute__((packed));
+
+// The common part of all MADT entries.
+struct madt_entry {
+  uint8_t type;
+  uint8_t length;
+} __attribute__((packed));
+
+enum : uint8_t {
+  MADT_LAPIC = 0,
+  MADT_X2APIC = 9,
+};
+
+struct madt_lapic {
+  madt_entry entry;
+  uint8_t processor_uid;
+  uint8_t apic_id;
+  uint32_t flags;
+} __attribute__((packed));
+
+struct madt_x2apic {
+  madt_entry entry;
+  uint16_t reserved;
+  uint32_t x2apic_id;
+  uint32_t flags;
+  uint32_t processor_uid;
+} __attribute__((packed));
+
+enum : uint32_t {
+  MADT_LAPIC_ENABLED = 1 << 0,
+};
+
+struct srat {
+  acpi_table_header header;
+  uint32_t reserved0;
+  uint64_t reserved1;
+} __attribute__((packed));
+
+enum : uint8_t {
+  SRAT_LAPIC = 0,
+  SRAT_MEMORY = 1,
+  SRAT_X2APIC = 2,
+};
+
+struct srat_lapic {
+  madt_entry entry;
+  uint8_t proximity_domain_lo;
+  uint8_t apic_id;
+  uint32_t flags;
+  uint8_t sapic_eid;
+  uint8_t proximity_domain_hi[3];
+  uint32_t clock_domain;
+} __attribute__((packed));
+
+struct srat_memory {
+  madt_entry entry;
+  uint32_t proximity_domain;
+  uint16_t reserved0;
+  uint64_t base;
+  uint64_t length;
+  uint32_t reserved1;
+  uint32_t flags;
+  uint64_t reserved2;
+} __attribute__((packed));
+
+struct srat_x2apic {
+  madt_entry entry;
+  uint16_t reserved0;
+  uint32_t proximity_domain;
+  uint32_t x2apic_id;
+  uint32_t flags;
+  uint32_t clock_domain;
+  uint32_t reserved1;
+} __attribute__((packed));
+
+enum : uint32_t {
+  SRAT_ENABLED = 1 << 0,
+};
+
+}
+
+// Physical memory is identity mapped.
+template <typename T>
+static T const *phys_to_ptr(uint64_t phys)
+{
+  uintptr_t addr = static_cast<uintptr_t>(phys);
+
+  // Keep the compiler from treating constant addresses as out-of-bounds
+  // accesses.
+  asm ("" : "+r" (addr));
+  return reinterpret_cast<T const *>(addr);
+}
+
+static bool checksum_ok(void const *p, size_t length)
+{
+  uint8_t sum = 0;
+
+  for (size_t i = 0; i < length; i++)
+    sum += static_cast<uint8_t const *>(p)[i];
+
+  return sum == 0;
+}
+
+// The RSDP is 16-byte aligned in the given memory range.
+static rsdp const *find_rsdp_in(uintptr_t from, size_t length)
+{
+  for (uintptr_t p = from; p + sizeof(rsdp) <= from + length; p += 16) {
+    auto const candidate = phys_to_ptr<rsdp>(p);
+
+    if (memcmp(candidate->signature, "RSD PTR ", sizeof(candidate->signature)) == 0 and
+        checksum_ok(candidate, 20))
+      return candidate;
+  }
+
+  return nullptr;
+}
+
+// See ACPI Specification 6.4, Chapter 5.2.5.1 "Finding the RSDP on IA-PC
+// Systems".
+static rsdp const *find_rsdp()
+{
+  uintptr_t const ebda = static_cast<uintptr_t>(*phys_to_ptr<uint16_t>(0x40E)) << 4;
+  rsdp const *res = ebda ? find_rsdp_in(ebda, 1024) : nullptr;
+
+  return res ? res : find_rsdp_in(0xE0000, 0x20000);
+}
+
+acpi_table_header const *find_acpi_table(char const *signature)
+{
+  static rsdp const *rsdp = find_rsdp();
+
+  if (not rsdp)
+    return nullptr;
+
+  // Prefer the XSDT with its 64-bit pointers, if there is one.
+  bool const use_xsdt = rsdp->revision >= 2 and rsdp->xsdt_address != 0;
+  auto const sdt = phys_to_ptr<acpi_table_header>(use_xsdt ? rsdp->xsdt_address : rsdp->rsdt_address);
+  size_t const entry_size = use_xsdt ? sizeof(uint64_t) : sizeof(uint32_t);
+
+  if (not checksum_ok(sdt, sdt->length))
+    return nullptr;
+
+  auto const entries = reinterpret_cast<char const *>(sdt + 1);
+  size_t const entry_count = (sdt->length - sizeof(*sdt)) / entry_size;
+
+  for (size_t i = 0; i < entry_count; i++) {
+    uint64_t table_phys = 0;
+    memcpy(&table_phys, entries + i * entry_size, entry_size);
+
+    auto const table = phys_to_ptr<acpi_table_header>(table_phys);
+
+    if (memcmp(table->signature, signature, sizeof(table->signature)) == 0 and
+        checksum_ok(table, table->length))
+      return table;
+  }
+
+  return nullptr;
+}
+
+// Call fn for each of the variable-length entries that follow the fixed part of
+// type TABLE in the ACPI table with the given signature. MADT and SRAT entries
+// share the same header.
+template <typename TABLE, typename FN>
+static void for_each_entry(char const *signature, FN fn)
+{
+  auto const table = reinterpret_cast<TABLE const *>(find_acpi_table(signature));
+
+  if (not table)
+    return;
+
+  auto const start = reinterpret_cast<char const *>(table);
+
+  for (size_t offset = sizeof(*table); offset + sizeof(madt_entry) <= table->header.length;) {
+    auto const entry = reinterpret_cast<madt_entry const *>(start + offset);
+
+    if (entry->length < sizeof(madt_entry) or offset + entry->length > table->header.length)
+      break;
+
+    fn(*entry);
+    offset += entry->length;
+  }
+}
+
+size_t get_madt_apic_ids(uint32_t *apic_ids, size_t max_ids)
+{
+  size_t count = 0;
+
+  for_each_entry<madt>("APIC", [&] (madt_entry const &entry) {
+      if (count >= max_ids)
+        return;
+
+      if (entry.type == MADT_LAPIC) {
+        auto const &lapic = reinterpret_cast<madt_lapic const &>(entry);
+
+        if (lapic.flags & MADT_LAPIC_ENABLED)
+          apic_ids[count++] = lapic.apic_id;
+      } else if (entry.type == MADT_X2APIC) {
+        auto const &x2apic = reinterpret_cast<madt_x2apic const &>(entry);
+
+        if (x2apic.flags & MADT_LAPIC_ENABLED)
+          apic_ids[count++] = x2apic.x2apic_id;
+      }
+    });
+
+  return count;
+}
+
+size_t get_srat_memory_ranges(numa_memory_range *ranges, size_t max_ranges)
+{
+  size_t count = 0;
+
+  for_each_entry<srat>("SRAT", [&] (madt_entry const &entry) {
+      if (count >= max_ranges or entry.type != SRAT_MEMORY)
+        return;
+
+      auto const &memory = reinterpret_cast<srat_memory const &>(entry);
+
+      if (memory.flags & SRAT_ENABLED)
+        ranges[count++] = { memory.base, memory.length, memory.proximity_domain };
+    });
+
+  return count;
+}
+
+uint32_t get_srat_apic_node(uint32_t apic_id)
+{
+  uint32_t node = 0;
+
+  for_each_entry<srat>("SRAT", [&] (madt_entry const &entry) {
+      if (entry.type == SRAT_LAPIC) {
+        auto const &lapic = reinterpret_cast<srat_lapic const &>(entry);
+
+        if ((lapic.flags & SRAT_ENABLED) and lapic.apic_id == apic_id)
+          node = lapic.proximity_domain_lo |
+            (uint32_t)lapic.proximity_domain_hi[0] << 8 |
+            (uint32_t)lapic.proximity_domain_hi[1] << 16 |
+            (uint32_t)lapic.proximity_domain_hi[2] << 24;
+      } else if (entry.type == SRAT_X2APIC) {
+        auto const &x2apic = reinterpret_cast<srat_x2apic const &>(entry);
+
+        if ((x2apic.flags & SRAT_ENABLED) and x2apic.x2apic_id == apic_id)
+          node = x2apic.proximity_domain;
+      }
+    });
+
+  return node;
+}
@@ -0,0 +1,65 @@
+#include "apic.hpp"
+#include "msr.hpp"
+#include "x86.hpp"
+
+namespace {
+
+// xAPIC register offsets. See Intel SDM Vol. 3 Chapter 10.4.1.
+enum : uint32_t {
+  LAPIC_ID = 0x20,
+  LAPIC_ICR_LO = 0x300,
+  LAPIC_ICR_HI = 0x310,
+};
+
+enum : uint32_t {
+  ICR_INIT = 5 << 8,
+  ICR_STARTUP = 6 << 8,
+  ICR_PENDING = 1 << 12,
+  ICR_ASSERT = 1 << 14,
+};
+
+}
+
+static bool x2apic_enabled()
+{
+  return rdmsr(IA32_APIC_BASE) & IA32_APIC_BASE_EXTD;
+}
+
+static volatile uint32_t &lapic_reg(uint32_t offset)
+{
+  return *reinterpret_cast<volatile uint32_t *>(static_cast<uintptr_t>(get_lapic_base() + offset));
+}
+
+uint64_t get_lapic_base()
+{
+  return rdmsr(IA32_APIC_BASE) & ~0xFFFULL & ((1ULL << 52) - 1);
+}
+
+uint32_t get_lapic_id()
+{
+  return x2apic_enabled() ? (uint32_t)rdmsr(IA32_X2APIC_APICID) : lapic_reg(LAPIC_ID) >> 24;
+}
+
+static void send_ipi(uint32_t apic_id, uint32_t icr)
+{
+  if (x2apic_enabled()) {
+    wrmsr(IA32_X2APIC_ICR, (uint64_t)apic_id << 32 | icr);
+    return;
+  }
+
+  lapic_reg(LAPIC_ICR_HI) = apic_id << 24;
+  lapic_reg(LAPIC_ICR_LO) = icr;
+
+  while (lapic_reg(LAPIC_ICR_LO) & ICR_PENDING)
+    pause();
+}
+
+void send_init_ipi(uint32_t apic_id)
+{
+  send_ipi(apic_id, ICR_INIT | ICR_ASSERT);
+}
+
+void send_startup_ipi(uint32_t apic_id, uint8_t page)
+{
+  send_ipi(apic_id, ICR_STARTUP | ICR_ASSERT | page);
+}
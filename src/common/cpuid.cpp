@@ -20,6 +20,7 @@ cpu_signature get_cpu_signature()
   cpu_signature sig {};
 
   sig.signature = leaf1.eax;
+  sig.core_type = leaf0.eax >= 0x1A ? get_cpuid(0x1A).eax >> 24 : 0;
   memcpy(sig.vendor + 0, &leaf0.ebx, sizeof(uint32_t));
   memcpy(sig.vendor + 4, &leaf0.edx, sizeof(uint32_t));
   memcpy(sig.vendor + 8, &leaf0.ecx, sizeof(uint32_t));
@@ -0,0 +1,55 @@
+#include "cpuid.hpp"
+#include "fpu.hpp"
+#include "x86.hpp"
+#include "util.hpp"
+
+bool user_fpu_enabled = false;
+uint64_t user_fpu_components = 0;
+
+// An XSAVE area with all components in their initial configuration. XRSTOR
+// doesn't touch component areas that are marked as initial in the header, so
+// we only need the legacy area and the header.
+struct alignas(64) xsave_area {
+  uint16_t fcw;
+  uint8_t legacy0[22];
+  uint32_t mxcsr;
+  uint8_t legacy1[484];
+
+  uint64_t xstate_bv;
+  uint64_t xcomp_bv;
+  uint8_t header_reserved[48];
+};
+
+static_assert(sizeof(xsave_area) == 512 + 64, "XSAVE area layout broken");
+
+static xsave_area const clean_fpu_state { 0x37F, {}, mxcsr_default, {}, 0, 0, {} };
+
+void setup_fpu()
+{
+  set_cr0(get_cr0() | CR0_TS);
+}
+
+bool enable_user_fpu()
+{
+  bool const has_xsave = get_cpuid(1).ecx & (1 << 26 /* XSAVE */);
+
+  if (not has_xsave or get_cpuid_max_std_level() < 0xD or
+      not (get_cpuid(0xD, 1).eax & (1 << 2 /* XGETBV with ECX=1 */))) {
+    return false;
+  }
+
+  set_cr4(get_cr4() | CR4_OSFXSR | CR4_OSXSAVE);
+  set_xcr0(get_xcr0() | XCR0_X87 | XCR0_SSE);
+
+  user_fpu_components = get_xcr0();
+  clts();
+  restore_clean_fpu();
+
+  user_fpu_enabled = true;
+  return true;
+}
+
+void restore_clean_fpu()
+{
+  xrstor(&clean_fpu_state, user_fpu_components);
+}
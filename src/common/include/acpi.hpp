@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The common header of all ACPI system description tables.
+struct acpi_table_header {
+  char signature[4];
+  uint32_t length;
+  uint8_t revision;
+  uint8_t checksum;
+  char oem_id[6];
+  char oem_table_id[8];
+  uint32_t oem_revision;
+  uint32_t creator_id;
+  uint32_t creator_revision;
+} __attribute__((packed));
+
+static_assert(sizeof(acpi_table_header) == 36, "ACPI table header layout broken");
+
+// Find the ACPI table with the given signature. Returns nullptr, if there is
+// no such table or it is corrupt. ACPI tables need to be identity mapped.
+acpi_table_header const *find_acpi_table(char const *signature);
+
+// Fill apic_ids with the APIC IDs of all usable processors in the MADT and
+// return how many there are. At most max_ids entries are written.
+size_t get_madt_apic_ids(uint32_t *apic_ids, size_t max_ids);
+
+// A range of physical memory and the NUMA node (proximity domain) it belongs
+// to.
+struct numa_memory_range {
+  uint64_t base;
+  uint64_t length;
+  uint32_t node;
+};
+
+// Fill ranges with the enabled memory ranges from the SRAT and return how many
+// there are. At most max_ranges entries are written. Returns zero, if there is
+// no SRAT.
+size_t get_srat_memory_ranges(numa_memory_range *ranges, size_t max_ranges);
+
+// Return the NUMA node of the CPU with the given APIC ID. Returns zero, if the
+// SRAT doesn't say.
+uint32_t get_srat_apic_node(uint32_t apic_id);
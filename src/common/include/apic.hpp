@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+// The local APIC of the current CPU. This works in xAPIC and x2APIC mode. In
+// xAPIC mode, the register page needs to be identity mapped uncacheable.
+
+// Return the physical address of the xAPIC register page.
+uint64_t get_lapic_base();
+
+// Return the APIC ID of the current CPU.
+uint32_t get_lapic_id();
+
+// Send an INIT IPI to the CPU with the given APIC ID.
+void send_init_ipi(uint32_t apic_id);
+
+// Send a STARTUP IPI to the CPU with the given APIC ID. The CPU starts
+// executing in real mode at physical address page << 12.
+void send_startup_ipi(uint32_t apic_id, uint8_t page);
@@ -1,3 +1,4 @@
 #pragma once
 
-void try_setup_avx();
+// Enable AVX state, if the CPU supports it. Returns true, if AVX is enabled.
+bool try_setup_avx();
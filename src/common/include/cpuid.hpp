@@ -11,6 +11,11 @@ struct cpuid_result {
 
 struct cpu_signature {
   uint32_t signature;
+
+  // The hybrid core type from CPUID leaf 1AH (0x20 for Atom, 0x40 for Core)
+  // or zero, if the CPU doesn't report one.
+  uint8_t core_type;
+
   char vendor[3*4 + 1];
 };
 
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+#include "x86.hpp"
+
+// The kernel itself never touches x87/SSE/AVX state (see SConstruct), so the
+// FPU configuration only matters for user space.
+
+// Disable the FPU via CR0.TS. Any FPU instruction in user space raises #NM.
+void setup_fpu();
+
+// Let user space use the FPU. Instead of toggling CR0.TS on every ring
+// transition, state is reset only when user code has modified it. Returns
+// false, if the CPU cannot tell us which state was modified.
+bool enable_user_fpu();
+
+extern bool user_fpu_enabled;
+extern uint64_t user_fpu_components;
+
+constexpr uint32_t mxcsr_default = 0x1F80;
+
+void restore_clean_fpu();
+
+// Bring FPU state back to its initial configuration, if user code modified it.
+// XINUSE doesn't cover MXCSR, so we check it separately.
+inline void reset_user_fpu()
+{
+  if (user_fpu_enabled and
+      ((get_xinuse() & user_fpu_components) or get_mxcsr() != mxcsr_default))
+    restore_clean_fpu();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// A bounded lock-free ring for many producers and a single consumer. Producers
+// never wait for each other. Only one CPU at a time may pop.
+template <typename T, size_t N>
+class mpsc_ring {
+  static_assert((N & (N - 1)) == 0, "Capacity needs to be a power of two");
+
+  // The turn of a slot is 2 * lap, if it is free for the producer of that
+  // lap, and 2 * lap + 1, if it holds its item. This makes an all-zero ring
+  // empty.
+  struct slot {
+    uint64_t turn;
+    T item;
+  };
+
+  alignas(64) uint64_t head_ = 0;
+  alignas(64) uint64_t tail_ = 0;
+
+  slot slots_[N];
+
+  static uint64_t free_turn(uint64_t pos)
+  {
+    return 2 * (pos / N);
+  }
+
+public:
+
+  // Returns false, if the ring is full.
+  bool push(T const &item)
+  {
+    uint64_t pos = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+
+    for (;;) {
+      slot &s = slots_[pos % N];
+      int64_t const diff = __atomic_load_n(&s.turn, __ATOMIC_ACQUIRE) - free_turn(pos);
+
+      if (diff == 0) {
+        if (__atomic_compare_exchange_n(&head_, &pos, pos + 1, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+          s.item = item;
+          __atomic_store_n(&s.turn, free_turn(pos) + 1, __ATOMIC_RELEASE);
+          return true;
+        }
+
+        // The failed compare-exchange has updated pos.
+      } else if (diff < 0) {
+        // The consumer hasn't taken the item from the last lap yet.
+        return false;
+      } else {
+        pos = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+      }
+    }
+  }
+
+  // Take the oldest item. Returns false, if the ring is empty or the oldest
+  // item is still being written.
+  bool pop(T &item)
+  {
+    slot &s = slots_[tail_ % N];
+
+    if (__atomic_load_n(&s.turn, __ATOMIC_ACQUIRE) != free_turn(tail_) + 1)
+      return false;
+
+    item = s.item;
+    __atomic_store_n(&s.turn, free_turn(tail_ + N), __ATOMIC_RELEASE);
+    __atomic_store_n(&tail_, tail_ + 1, __ATOMIC_RELAXED);
+    return true;
+  }
+
+  // The number of items pushed and not popped yet. This is only a snapshot.
+  size_t size() const
+  {
+    uint64_t const tail = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&head_, __ATOMIC_ACQUIRE) - tail;
+  }
+};
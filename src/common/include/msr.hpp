@@ -4,10 +4,23 @@
 #include <cstdint>
 
 enum : uint32_t {
+  IA32_APIC_BASE = 0x1B,
+  IA32_X2APIC_APICID = 0x802,
+  IA32_X2APIC_ICR = 0x830,
   IA32_EFER = 0xC0000080,
+  IA32_STAR = 0xC0000081,
+  IA32_LSTAR = 0xC0000082,
+  IA32_FMASK = 0xC0000084,
+  IA32_KERNEL_GS_BASE = 0xC0000102,
 };
 
 enum : uint64_t {
+  IA32_APIC_BASE_EXTD = 1 << 10,
+  IA32_APIC_BASE_EN = 1 << 11,
+};
+
+enum : uint64_t {
+  IA32_EFER_SCE = 1 << 0,
   IA32_EFER_NXE = 1 << 11,
 };
 
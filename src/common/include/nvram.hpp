@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+#include "execution_attempt.hpp"
+#include "search.hpp"
+
+// The progress of a sweep as we keep it in CMOS NVRAM across resets.
+struct nvram_checkpoint {
+  search_checkpoint checkpoint;
+  execution_attempt last;
+
+  // The sweep has run to completion.
+  bool finished;
+};
+
+// Identify a sweep by its command line. Only checkpoints of the same sweep
+// are resumed.
+uint16_t nvram_run_id(const char *cmdline);
+
+// Look for the newest valid checkpoint of the given sweep. Later calls to
+// save_nvram_checkpoint() save checkpoints for this sweep. Returns false, if
+// there is none.
+bool load_nvram_checkpoint(uint16_t run_id, nvram_checkpoint &res);
+
+// Save a checkpoint. We alternate between two slots, so a reset in the middle
+// of this never loses the previous checkpoint.
+void save_nvram_checkpoint(nvram_checkpoint const &checkpoint);
@@ -1,11 +1,28 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 class output_device {
 public:
 
   virtual void putc(char c) = 0;
   virtual void puts(const char *s);
 
+  // Devices that can take many bytes at once should override this.
+  virtual void write(const char *s, size_t length);
+
+  // Switch to the given serial port and baud rate. A zero port keeps the
+  // current one. Devices that are not serial ports ignore this.
+  virtual void configure_serial(uint16_t, uint32_t) {}
+
+  // Let the device write out in the background driven by interrupts. Returns
+  // false, if it can't.
+  virtual bool enable_interrupts() { return false; }
+
+  // Wait until everything that was written is really out.
+  virtual void sync() {}
+
   // Factory method.
   static output_device *make();
 };
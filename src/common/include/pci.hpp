@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+// A PCI function as bus, device and function number.
+struct pci_address {
+  uint8_t bus;
+  uint8_t device;
+  uint8_t function;
+};
+
+// Access PCI configuration space with the legacy I/O port mechanism. The
+// offset needs to be 32-bit aligned.
+uint32_t pci_read_config(pci_address const &address, uint8_t offset);
+void pci_write_config(pci_address const &address, uint8_t offset, uint32_t value);
+
+// Find the first function with the given vendor and device ID. Returns false,
+// if there is none.
+bool pci_find_device(uint16_t vendor, uint16_t device, pci_address &res);
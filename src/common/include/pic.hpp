@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// The legacy 8259 interrupt controllers. They deliver to the boot CPU, if the
+// BIOS left the local APIC in virtual wire mode.
+
+// We move the PIC interrupts out of the way of exceptions to these vectors.
+constexpr size_t pic_vector_base = 32;
+constexpr size_t pic_irq_count = 16;
+
+// Call the handler for the given IRQ and unmask it. The first call
+// initializes the PICs with all other IRQs masked.
+void enable_irq(size_t irq, void (*handler)());
+
+// Handle an interrupt with a vector from pic_vector_base on.
+void handle_pic_interrupt(size_t vector);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <cstdint>
+
+// Busy-wait for the given number of microseconds using PIT channel 2.
+void udelay(uint32_t us);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+#include "execution_attempt.hpp"
+#include "search.hpp"
+
+// What one CPU made of an instruction.
+struct cpu_verdict {
+  execution_attempt attempt;
+  uint16_t cpu = 0;
+
+  // The CPU signature and hybrid core type. See cpu_signature. These are only
+  // filled in for disagreements.
+  uint32_t signature = 0;
+  uint8_t core_type = 0;
+};
+
+enum class result_kind : uint8_t {
+  instruction,
+
+  // Another CPU executed the same instruction and came to a different
+  // conclusion. See result_record::checked.
+  disagreement,
+
+  // Where a search was at this point. See result_record::checkpoint.
+  checkpoint,
+};
+
+// An interesting instruction as it travels from the CPU that found it to the
+// output device.
+struct result_record {
+  instruction_bytes instr;
+  cpu_verdict found;
+
+  result_kind kind;
+  cpu_verdict checked;
+
+  // For checkpoints, found.attempt is the last execution attempt before it.
+  search_checkpoint checkpoint;
+};
+
+// Queue a result for output. This only waits, if the queue is full.
+void report_result(instruction_bytes const &instr, execution_attempt const &attempt);
+
+// Queue a disagreement between two CPUs for output.
+void report_disagreement(instruction_bytes const &instr,
+                         cpu_verdict const &found, cpu_verdict const &checked);
+
+// Queue a checkpoint that allows to resume the search from this point. Because
+// it travels through the same queue, all results found before it are written
+// out before it.
+void report_checkpoint(search_checkpoint const &checkpoint, execution_attempt const &last);
+
+// From now on, write instruction results in the compact binary format below
+// instead of text. This must not race with drain_results() or anyone else
+// printing, so call it before sifting starts.
+//
+// The binary results follow a ">>> Binary results follow." line and start with
+// the magic "BSR" and a version byte. Then there is a sequence of records. A
+// record starts with a byte b:
+//
+//  - b >= 0x10 is an instruction. Its length is b >> 4 and its exception is
+//    b & 0xF. If that is 0xF, the exception is in the next byte. The next byte
+//    is how many leading bytes it has in common with the previous
+//    instruction. Only the remaining bytes follow.
+//  - b == 0x00 is followed by a line of text that ends with a newline. Any
+//    text that is printed in binary mode ends up in such a record.
+//  - b == 0x0F ends the binary results.
+void start_binary_results();
+
+// Go back to text after start_binary_results().
+void end_binary_results();
+
+// Write out queued results, unless another CPU is already doing that. This
+// doesn't return before the queue is empty.
+void drain_results();
+
+// Write out queued results, if the queue is filling up. This is cheap enough
+// to call often.
+void drain_results_if_needed();
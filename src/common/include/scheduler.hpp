@@ -0,0 +1,22 @@
+#pragma once
+
+#include "search.hpp"
+
+// Distributes parts of the search space between CPUs. Every CPU starts with
+// its own range. CPUs that run out of work steal ranges that busy CPUs split
+// off their current search.
+
+// Return true, if there is an idle CPU and nobody has offered it any work
+// yet. This is cheap enough to call often.
+bool work_wanted();
+
+// Make a range available to idle CPUs.
+void offer_work(search_range const &range);
+
+// Find a range to work on. Returns false, if all CPUs are idle and there is no
+// work left. While we wait, we call help_out.
+bool find_work(search_range &range, void (*help_out)());
+
+// Stop taking part in the search. Ranges that were offered by this CPU and not
+// taken yet stay available to the other CPUs.
+void stop_working();
@@ -1,23 +1,94 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 // A raw set of bytes representing an instruction (potentially).
-struct instruction_bytes {
+struct alignas(16) instruction_bytes {
   // x86 instructions are at most 15 bytes long.
   uint8_t raw[15];
 
+  // Pads the bytes to two 64-bit words. This is always zero.
+  uint8_t padding = 0;
+
   template <typename... T>
   constexpr instruction_bytes(T... v)
   : raw {(uint8_t)v...}
   {}
+
+  // Access the bytes as two little-endian 64-bit words, i.e. byte i is in
+  // bits 8 * (i % 8) and up of word i / 8.
+  void load_words(uint64_t (&words)[2]) const
+  {
+    __builtin_memcpy(words, this, sizeof(words));
+  }
+
+  void store_words(uint64_t const (&words)[2])
+  {
+    __builtin_memcpy(this, words, sizeof(words));
+  }
 };
 
+static_assert(sizeof(instruction_bytes) == 2 * sizeof(uint64_t),
+              "Instruction bytes need to fit into two words");
+
+// Compare instruction bytes in search order.
+inline bool operator<(instruction_bytes const &a, instruction_bytes const &b)
+{
+  return __builtin_memcmp(a.raw, b.raw, sizeof(a.raw)) < 0;
+}
+
+// There are five groups of prefixes and each group may only appear once in a
+// candidate, so more prefixes than this are never accepted.
+constexpr size_t max_prefix_groups = 5;
+
+// A part of the search space: all candidates from start on that share the
+// bytes before pos with start and have a byte below end at pos. Usually, the
+// bytes after pos are zero.
+struct search_range {
+  instruction_bytes start;
+  size_t pos;
+  size_t end;
+};
+
+// The complete state of a search. See search_engine::get_checkpoint().
+struct search_checkpoint {
+  instruction_bytes current;
+  size_t increment_at;
+  size_t base_pos;
+  size_t end;
+};
+
+// Enumerates instruction candidates in lexicographic order. The prefix budget
+// is a template parameter, so the common case without prefixes compiles down
+// to a simple increment.
+template <size_t MAX_PREFIXES>
 class search_engine {
+  static_assert(MAX_PREFIXES <= max_prefix_groups, "Prefix budget is too large");
+
   instruction_bytes current_;
   size_t increment_at_ = 0;
 
-  const size_t max_prefixes_;
+  // The number of prefix bytes at the start of current_.
+  size_t prefix_bytes_ = 0;
+
+  // We never increment left of this position and the byte at this position
+  // stays below end_. See search_range.
+  size_t base_pos_ = 0;
+  size_t end_ = 256;
+
+  // There is no candidate at all.
+  bool empty_ = false;
+
+  // Return the smallest prefix group that is acceptable at increment_at_, if
+  // prefixes_before bytes before it are prefixes. Returns max_prefix_groups,
+  // if no prefix is acceptable.
+  size_t min_prefix_group(size_t prefixes_before) const;
+
+  // Set the byte at increment_at_ to the smallest acceptable value that is not
+  // smaller than from and return it. Zero means there is none, unless from was
+  // zero.
+  uint8_t set_acceptable_byte(uint8_t from);
 
 public:
 
@@ -26,6 +97,8 @@ public:
   bool find_next_candidate();
 
   // Reset the incrementing position after an interesting instruction was found.
+  // If the instruction ends before the base position, a sequential search would
+  // leave our range here, so we are done after this candidate.
   void start_over(size_t length);
 
   // Clear any bytes after the given position.
@@ -37,7 +110,31 @@ public:
     return current_;
   }
 
-  search_engine(size_t max_prefixes = 0, instruction_bytes const &start = {})
-    : current_(start), max_prefixes_(max_prefixes)
-  {}
+  // The start candidate has to have acceptable prefixes. We begin
+  // incrementing at its last non-zero byte.
+  search_engine(instruction_bytes const &start = {});
+
+  // Only enumerate candidates in the given range. We begin with the smallest
+  // acceptable candidate in it and increment at the last non-zero byte of its
+  // start.
+  search_engine(search_range const &range);
+
+  // Continue a search exactly where get_checkpoint() left off.
+  search_engine(search_checkpoint const &checkpoint);
+
+  search_checkpoint get_checkpoint() const
+  {
+    return { current_, increment_at_, base_pos_, end_ };
+  }
+
+  // Hand out the upper half of the candidates we haven't looked at yet at the
+  // leftmost position where there are any. Returns false, if there is nothing
+  // to hand out.
+  bool split(search_range &upper);
+
+  // Return true, if there are no acceptable candidates at all.
+  bool is_empty() const
+  {
+    return empty_;
+  }
 };
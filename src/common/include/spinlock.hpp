@@ -0,0 +1,30 @@
+#pragma once
+
+#include "x86.hpp"
+
+// A test-and-test-and-set lock for the few places where CPUs share state.
+class spinlock {
+  bool locked_ = false;
+
+public:
+
+  void lock()
+  {
+    while (__atomic_exchange_n(&locked_, true, __ATOMIC_ACQUIRE)) {
+      while (__atomic_load_n(&locked_, __ATOMIC_RELAXED))
+        pause();
+    }
+  }
+
+  // Returns false, if someone else holds the lock.
+  bool try_lock()
+  {
+    return not __atomic_load_n(&locked_, __ATOMIC_RELAXED) and
+      not __atomic_exchange_n(&locked_, true, __ATOMIC_ACQUIRE);
+  }
+
+  void unlock()
+  {
+    __atomic_store_n(&locked_, false, __ATOMIC_RELEASE);
+  }
+};
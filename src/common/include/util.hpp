@@ -3,7 +3,7 @@
 #include <cstddef>
 #include <cstdint>
 
-#define unlikely(x) __builtin_expect(!!x, 0)
+#define unlikely(x) __builtin_expect(!!(x), 0)
 
 // Return the number of entries of a C-style array.
 template <typename T, size_t N>
@@ -11,7 +11,7 @@ constexpr size_t array_size(T(&)[N]) { return N; }
 
 // Return the bits in the range from high (non-inclusive) to low (inclusive)
 // extracted from value.
-inline uint64_t bit_select(int high, int low, uint64_t value)
+constexpr uint64_t bit_select(int high, int low, uint64_t value)
 {
   return (value >> low) & ((1UL << (high - low)) - 1);
 }
@@ -36,6 +36,30 @@ inline formatted_int hex(uint64_t v, unsigned width = 0, bool prefix = true)
 //void print(uint64_t v);
 void print(formatted_int const &v);
 
+// Print bytes that may include zeros. They are written out together.
+void print_raw(const char *data, size_t length);
+
+// While this is on, every line printed with print() goes out as a text record
+// of the binary result format, i.e. prefixed with a zero byte. print_raw() is
+// not affected. See start_binary_results().
+void set_binary_output(bool on);
+
+// Write out everything this CPU has printed so far. See print().
+void flush_output();
+
+// Like flush_output(), but also wait until the output device is done with
+// it. Use this before resetting the machine.
+void sync_output();
+
+// Let the output device write out in the background driven by interrupts.
+// This enables interrupts on the current CPU. Returns false, if the device
+// doesn't support this.
+bool enable_output_interrupts();
+
+// Switch serial output to another port and baud rate. A zero port keeps the
+// current one. This does nothing, if we don't print to a serial port.
+void configure_serial_output(uint16_t port, uint32_t baud);
+
 template <typename T>
 void format(T const &t)
 {
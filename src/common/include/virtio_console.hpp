@@ -0,0 +1,10 @@
+#pragma once
+
+#include "output_device.hpp"
+
+// Look for a virtio console on the PCI bus and set it up for output. Returns
+// nullptr, if there is none we can use.
+//
+// This only speaks the legacy virtio interface, so the device has to be
+// transitional. QEMU's virtio-serial-pci is, unless it sits on a PCIe port.
+output_device *make_virtio_console();
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// A bounded lock-free work-stealing deque (Chase-Lev). Only the owning CPU may
+// push and pop at the bottom. Any CPU may steal from the top.
+template <typename T, size_t N>
+class work_deque {
+  static_assert((N & (N - 1)) == 0, "Capacity needs to be a power of two");
+
+  // The indices only ever grow. They are signed, because the owner
+  // temporarily moves bottom_ below top_ when it pops from an empty deque.
+  alignas(64) int64_t top_ = 0;
+  alignas(64) int64_t bottom_ = 0;
+
+  T items_[N];
+
+public:
+
+  // Returns false, if the deque is full.
+  bool push(T const &item)
+  {
+    int64_t const b = __atomic_load_n(&bottom_, __ATOMIC_RELAXED);
+    int64_t const t = __atomic_load_n(&top_, __ATOMIC_ACQUIRE);
+
+    if (b - t >= (int64_t)N)
+      return false;
+
+    items_[b & (N - 1)] = item;
+    __atomic_store_n(&bottom_, b + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  // Take the most recently pushed item. Returns false, if there is none.
+  bool pop(T &item)
+  {
+    int64_t const b = __atomic_load_n(&bottom_, __ATOMIC_RELAXED) - 1;
+
+    __atomic_store_n(&bottom_, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    int64_t t = __atomic_load_n(&top_, __ATOMIC_RELAXED);
+    bool success = t <= b;
+
+    if (success) {
+      item = items_[b & (N - 1)];
+
+      // This was the last item, so we race with thieves for it.
+      if (t == b) {
+        success = __atomic_compare_exchange_n(&top_, &t, t + 1, false,
+                                              __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        __atomic_store_n(&bottom_, b + 1, __ATOMIC_RELAXED);
+      }
+    } else {
+      __atomic_store_n(&bottom_, b + 1, __ATOMIC_RELAXED);
+    }
+
+    return success;
+  }
+
+  // Take the oldest item. Returns false, if there is none or we lost a race
+  // with the owner or another thief.
+  bool steal(T &item)
+  {
+    int64_t t = __atomic_load_n(&top_, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t const b = __atomic_load_n(&bottom_, __ATOMIC_ACQUIRE);
+
+    if (t >= b)
+      return false;
+
+    // The owner never overwrites this slot before top_ moves past t, so the
+    // copy is only used if the compare-exchange below succeeds.
+    item = items_[t & (N - 1)];
+
+    return __atomic_compare_exchange_n(&top_, &t, t + 1, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+  }
+
+  bool is_empty() const
+  {
+    return __atomic_load_n(&bottom_, __ATOMIC_RELAXED) <=
+      __atomic_load_n(&top_, __ATOMIC_RELAXED);
+  }
+};
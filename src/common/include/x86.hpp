@@ -17,17 +17,32 @@ enum : mword_t {
   PTE_P = 1 << 0,
   PTE_W = 1 << 1,
   PTE_U = 1 << 2,
+  PTE_PWT = 1 << 3,
+  PTE_PCD = 1 << 4,
   PTE_PS = 1 << 7,
 };
 
 enum : mword_t {
+  CR0_TS = 1 << 3,
   CR0_WP = 1 << 16,
   CR0_PG = 1U << 31,
 
   CR4_PSE = 1 << 4,
+  CR4_OSFXSR = 1 << 9,
+  CR4_OSXSAVE = 1 << 18,
   CR4_SMEP = 1 << 20,
 };
 
+enum : uint64_t {
+  XCR0_X87 = 1 << 0,
+  XCR0_SSE = 1 << 1,
+  XCR0_AVX = 1 << 2,
+};
+
+enum : mword_t {
+  FLAGS_IF = 1 << 9,
+};
+
 enum : mword_t {
   EXC_PF_ERR_P = 1 << 0,
   EXC_PF_ERR_W = 1 << 1,
@@ -195,6 +210,22 @@ struct gdt_desc {
     return t;
   }
 
+#ifdef __x86_64__
+  // A flat 64-bit CPL3 data segment followed by a flat 64-bit CPL3 code
+  // segment. Both are legacy 8-byte descriptors packed into one slot. This is
+  // the order SYSRET expects.
+  static gdt_desc user_data_code64_desc()
+  {
+    gdt_desc t = user_data64_desc();
+    gdt_desc const code = user_code64_desc();
+
+    t.base_hi2 = code.limit_lo | (uint32_t)code.base_lo << 16;
+    t.reserved = code.base_mid | (uint32_t)code.type_dpl << 8 |
+      (uint32_t)code.limit_flags << 16 | (uint32_t)code.base_hi << 24;
+    return t;
+  }
+#endif
+
   // A flat 32-bit CPL3 data segment.
   static gdt_desc user_data32_desc()
   {
@@ -284,6 +315,12 @@ inline void outb(uint16_t port, uint8_t data)
   asm volatile ("outb %%al, (%%dx)" :: "d" (port), "a" (data));
 }
 
+// Repeated 8-bit OUT operation from memory
+inline void outsb(uint16_t port, const void *data, size_t count)
+{
+  asm volatile ("rep outsb" : "+S" (data), "+c" (count) : "d" (port) : "memory");
+}
+
 // Generic 8-bit IN operation
 inline uint8_t inb(uint16_t port)
 {
@@ -292,11 +329,41 @@ inline uint8_t inb(uint16_t port)
   return v;
 }
 
+// Generic 16-bit OUT operation
+inline void outw(uint16_t port, uint16_t data)
+{
+  asm volatile ("outw %%ax, (%%dx)" :: "d" (port), "a" (data));
+}
+
+// Generic 16-bit IN operation
+inline uint16_t inw(uint16_t port)
+{
+  uint16_t v;
+  asm volatile ("inw (%%dx), %%ax" : "=a" (v) : "d" (port));
+  return v;
+}
+
+// Generic 32-bit OUT operation
+inline void outl(uint16_t port, uint32_t data)
+{
+  asm volatile ("outl %%eax, (%%dx)" :: "d" (port), "a" (data));
+}
+
+// Generic 32-bit IN operation
+inline uint32_t inl(uint16_t port)
+{
+  uint32_t v;
+  asm volatile ("inl (%%dx), %%eax" : "=a" (v) : "d" (port));
+  return v;
+}
+
 inline void set_cr0(mword_t v) { asm volatile ("mov %0, %%cr0" :: "r" (v)); }
 inline void set_cr2(mword_t v) { asm volatile ("mov %0, %%cr2" :: "r" (v)); }
 inline void set_cr3(mword_t v) { asm volatile ("mov %0, %%cr3" :: "r" (v) : "memory"); }
 inline void set_cr4(mword_t v) { asm volatile ("mov %0, %%cr4" :: "r" (v)); }
 
+inline void invlpg(uintptr_t v) { asm volatile ("invlpg (%0)" :: "r" (v) : "memory"); }
+
 inline mword_t get_cr0() { mword_t v; asm volatile ("mov %%cr0, %0" : "=r" (v)); return v; }
 inline mword_t get_cr2() { mword_t v; asm volatile ("mov %%cr2, %0" : "=r" (v)); return v; }
 inline mword_t get_cr3() { mword_t v; asm volatile ("mov %%cr3, %0" : "=r" (v)); return v; }
@@ -315,6 +382,33 @@ inline uint64_t get_xcr0()
   return (uint64_t)hi << 32 | lo;
 }
 
+// Return which state components are not in their initial configuration.
+// Requires CPUID.(EAX=0DH,ECX=1):EAX[2].
+inline uint64_t get_xinuse()
+{
+  uint32_t lo, hi;
+  asm volatile ("xgetbv" : "=d" (hi), "=a" (lo) : "c" (1));
+  return (uint64_t)hi << 32 | lo;
+}
+
+inline void xrstor(void const *area, uint64_t components)
+{
+  asm volatile ("xrstor %0" :: "m" (*(char const *)area),
+                "d" ((uint32_t)(components >> 32)), "a" ((uint32_t)components));
+}
+
+inline uint32_t get_mxcsr()
+{
+  uint32_t v;
+  asm volatile ("stmxcsr %0" : "=m" (v));
+  return v;
+}
+
+inline void clts()
+{
+  asm volatile ("clts");
+}
+
 inline uint64_t rdtsc()
 {
   uint32_t hi, lo;
@@ -326,3 +420,20 @@ inline void pause()
 {
   asm volatile ("pause");
 }
+
+inline void cli()
+{
+  asm volatile ("cli" ::: "memory");
+}
+
+inline void sti()
+{
+  asm volatile ("sti" ::: "memory");
+}
+
+inline bool interrupts_enabled()
+{
+  mword_t flags;
+  asm volatile ("pushf ; pop %0" : "=r" (flags));
+  return flags & FLAGS_IF;
+}
@@ -0,0 +1,165 @@
+#include "nvram.hpp"
+#include "util.hpp"
+#include "x86.hpp"
+
+namespace {
+
+enum : uint16_t {
+  CMOS_INDEX = 0x70,
+  CMOS_DATA = 0x71,
+};
+
+// A checkpoint as it is stored in NVRAM. All fields are bytes, so there is no
+// padding.
+struct nvram_slot {
+  // Tells us which slot is newer.
+  uint8_t sequence;
+  uint8_t run_id[2];
+  uint8_t finished;
+
+  uint8_t current[15];
+
+  // increment_at in the high and base_pos in the low nibble.
+  uint8_t position;
+
+  // end is never zero for a search that has anything left.
+  uint8_t end_minus_one;
+
+  uint8_t last_length;
+  uint8_t last_exception;
+
+  // Makes all bytes of a valid slot add up to slot_sum.
+  uint8_t checksum;
+};
+
+}
+
+// The BIOS keeps its settings in the lower half of the standard 128 bytes of
+// CMOS. The areas at 0x40 and 0x60 are unused by SeaBIOS and most PCs, but
+// this is not guaranteed by anything.
+static const uint8_t slot_offsets[] { 0x40, 0x60 };
+
+static_assert(sizeof(nvram_slot) <= 0x5B - 0x40,
+              "Slot overlaps with what SeaBIOS uses");
+
+// An all-zero or all-ones slot is never valid.
+static const uint8_t slot_sum = 0xA5;
+
+static uint16_t current_run_id;
+static size_t next_slot;
+static uint8_t next_sequence;
+
+static uint8_t cmos_read(uint8_t index)
+{
+  outb(CMOS_INDEX, index);
+  return inb(CMOS_DATA);
+}
+
+static void cmos_write(uint8_t index, uint8_t value)
+{
+  outb(CMOS_INDEX, index);
+  outb(CMOS_DATA, value);
+}
+
+static uint8_t sum_bytes(nvram_slot const &slot)
+{
+  auto const bytes = reinterpret_cast<uint8_t const *>(&slot);
+  uint8_t sum = 0;
+
+  for (size_t i = 0; i < sizeof(slot); i++)
+    sum += bytes[i];
+
+  return sum;
+}
+
+static void read_slot(size_t i, nvram_slot &slot)
+{
+  auto const bytes = reinterpret_cast<uint8_t *>(&slot);
+
+  for (size_t j = 0; j < sizeof(slot); j++)
+    bytes[j] = cmos_read(slot_offsets[i] + j);
+}
+
+static void write_slot(size_t i, nvram_slot const &slot)
+{
+  auto const bytes = reinterpret_cast<uint8_t const *>(&slot);
+
+  for (size_t j = 0; j < sizeof(slot); j++)
+    cmos_write(slot_offsets[i] + j, bytes[j]);
+}
+
+uint16_t nvram_run_id(const char *cmdline)
+{
+  // FNV-1a folded to 16 bits.
+  uint32_t hash = 2166136261u;
+
+  for (; *cmdline; cmdline++)
+    hash = (hash ^ (uint8_t)*cmdline) * 16777619u;
+
+  return (uint16_t)(hash ^ (hash >> 16));
+}
+
+bool load_nvram_checkpoint(uint16_t run_id, nvram_checkpoint &res)
+{
+  nvram_slot slots[array_size(slot_offsets)];
+  size_t newest = array_size(slots);
+
+  for (size_t i = 0; i < array_size(slots); i++) {
+    auto const &slot = slots[i];
+
+    read_slot(i, slots[i]);
+
+    if (sum_bytes(slot) != slot_sum or
+        (slot.run_id[0] | slot.run_id[1] << 8) != run_id)
+      continue;
+
+    if (newest == array_size(slots) or
+        (int8_t)(slot.sequence - slots[newest].sequence) > 0)
+      newest = i;
+  }
+
+  current_run_id = run_id;
+
+  if (newest == array_size(slots)) {
+    next_slot = 0;
+    next_sequence = 0;
+    return false;
+  }
+
+  auto const &slot = slots[newest];
+
+  next_slot = (newest + 1) % array_size(slots);
+  next_sequence = slot.sequence + 1;
+
+  res = {};
+  __builtin_memcpy(res.checkpoint.current.raw, slot.current, sizeof(slot.current));
+  res.checkpoint.increment_at = slot.position >> 4;
+  res.checkpoint.base_pos = slot.position & 0xF;
+  res.checkpoint.end = slot.end_minus_one + 1u;
+  res.last = { slot.last_length, slot.last_exception };
+  res.finished = slot.finished != 0;
+
+  return true;
+}
+
+void save_nvram_checkpoint(nvram_checkpoint const &checkpoint)
+{
+  auto const &search = checkpoint.checkpoint;
+  nvram_slot slot {};
+
+  assert(search.increment_at < 16 and search.base_pos < 16, "Checkpoint doesn't fit");
+
+  slot.sequence = next_sequence++;
+  slot.run_id[0] = (uint8_t)current_run_id;
+  slot.run_id[1] = (uint8_t)(current_run_id >> 8);
+  slot.finished = checkpoint.finished;
+  __builtin_memcpy(slot.current, search.current.raw, sizeof(slot.current));
+  slot.position = (uint8_t)(search.increment_at << 4 | search.base_pos);
+  slot.end_minus_one = (uint8_t)(search.end - 1);
+  slot.last_length = checkpoint.last.length;
+  slot.last_exception = checkpoint.last.exception;
+  slot.checksum = slot_sum - sum_bytes(slot);
+
+  write_slot(next_slot, slot);
+  next_slot = (next_slot + 1) % array_size(slot_offsets);
+}
@@ -2,6 +2,9 @@
 
 #include "cpuid.hpp"
 #include "output_device.hpp"
+#include "pic.hpp"
+#include "spinlock.hpp"
+#include "virtio_console.hpp"
 #include "x86.hpp"
 
 void output_device::puts(const char *s)
@@ -11,6 +14,12 @@ void output_device::puts(const char *s)
     putc(c);
 }
 
+void output_device::write(const char *s, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+    putc(s[i]);
+}
+
 class qemu_output_device : public output_device {
   static constexpr uint16_t qemu_debug_port = 0xe9;
 public:
@@ -18,17 +27,48 @@ public:
   {
     outbi<qemu_debug_port>(c);;
   }
+
+  // Under KVM, every OUT is an exit to the VMM, but a string OUT is handled
+  // in large chunks.
+  void write(const char *s, size_t length) override
+  {
+    outsb(qemu_debug_port, s, length);
+  }
 };
 
 class serial_output_device : public output_device {
   uint16_t base_port_;
 
+  // How many bytes the transmit FIFO takes before we have to wait for it to
+  // drain again.
+  size_t fifo_size_ = 1;
+  size_t tx_room_ = 0;
+
+  // With interrupts, output is queued here and the THRE interrupt moves it
+  // into the FIFO. The indices only ever grow.
+  static constexpr size_t tx_queue_size = 4096;
+
+  bool use_interrupts_ = false;
+  char tx_queue_[tx_queue_size];
+  size_t tx_head_ = 0;
+  size_t tx_tail_ = 0;
+
+  // Whoever holds this may touch the queue and the UART. The interrupt handler
+  // never waits for it. Instead, it sets tx_pending_ and whoever holds the lock
+  // fills the FIFO after unlocking.
+  spinlock tx_lock_;
+  bool tx_pending_ = false;
+
+  // For the interrupt handler.
+  static serial_output_device *interrupt_device_;
+
   enum class uart_reg {
     THR = 0,
     DLL = 0,
     DLH = 1,
     IER = 1,
     FCR = 2,
+    IIR = 2,
     LCR = 3,
     MCR = 4,
     LSR = 5,
@@ -43,12 +83,28 @@ class serial_output_device : public output_device {
     FCR_CLEAR_RX = 2,
     FCR_CLEAR_TX = 4,
 
+    IIR_FIFO_ENABLED = 0xC0,
+
+    IER_THRE = 0x02,
+
     MCR_DTS = 1,
     MCR_RTS = 2,
 
+    // This connects the interrupt line of the UART to the PIC.
+    MCR_OUT2 = 8,
+
+    // The transmit holding register and the FIFO behind it are empty.
     LSR_CAN_TX = 0x20,
+
+    // Additionally, the last byte has left the shift register.
+    LSR_TX_IDLE = 0x40,
   };
 
+  // A 16550A has a 16-byte FIFO. Older UARTs have none.
+  static constexpr size_t uart_fifo_size = 16;
+
+  static constexpr uint32_t max_baud = 115200;
+
   void out(uart_reg reg, uint8_t v)
   {
     outb(base_port_ + (uint16_t)reg, v);
@@ -59,37 +115,201 @@ class serial_output_device : public output_device {
     return inb(base_port_ + (uint16_t)reg);
   }
 
+  void setup(uint32_t baud)
+  {
+    uint16_t const divisor = (uint16_t)(max_baud / baud);
+
+    out(uart_reg::LCR, LCR_DLAB);
+    out(uart_reg::DLL, divisor & 0xFF);
+    out(uart_reg::DLH, divisor >> 8);
+
+    out(uart_reg::LCR, LCR_8BITDATA | LCR_1BITSTOP);
+    out(uart_reg::IER, use_interrupts_ ? IER_THRE : 0);
+    out(uart_reg::FCR, FCR_ENABLE_FIFO | FCR_CLEAR_RX | FCR_CLEAR_TX);
+    out(uart_reg::MCR, MCR_RTS | MCR_DTS | (use_interrupts_ ? MCR_OUT2 : 0));
+
+    bool const has_fifo = (in(uart_reg::IIR) & IIR_FIFO_ENABLED) == IIR_FIFO_ENABLED;
+
+    fifo_size_ = has_fifo ? uart_fifo_size : 1;
+    tx_room_ = 0;
+  }
+
+  // Move as much from the queue into the FIFO as it takes. This needs
+  // tx_lock_.
+  void fill_fifo()
+  {
+    if (tx_tail_ == tx_head_ or not (in(uart_reg::LSR) & LSR_CAN_TX))
+      return;
+
+    for (size_t i = 0; i < fifo_size_ and tx_tail_ != tx_head_; i++)
+      out(uart_reg::THR, (uint8_t)tx_queue_[tx_tail_++ % tx_queue_size]);
+  }
+
+  // Fill the FIFO on behalf of interrupts that came while someone else held
+  // the lock.
+  void handle_pending()
+  {
+    while (__atomic_exchange_n(&tx_pending_, false, __ATOMIC_SEQ_CST)) {
+      if (not tx_lock_.try_lock()) {
+        // Leave it to the lock holder, which looks at tx_pending_ after
+        // unlocking. But it may have looked before we put the flag back. If
+        // the lock is still taken now, its holder will see the flag.
+        // Otherwise, nobody might, so we go on ourselves.
+        __atomic_store_n(&tx_pending_, true, __ATOMIC_SEQ_CST);
+
+        if (not tx_lock_.try_lock())
+          return;
+      }
+
+      fill_fifo();
+      tx_lock_.unlock();
+    }
+  }
+
+  void queue(const char *s, size_t length)
+  {
+    tx_lock_.lock();
+
+    for (size_t i = 0; i < length; i++) {
+      // If the queue is full, we are as slow as the serial line after all.
+      while (tx_head_ - tx_tail_ == tx_queue_size) {
+        fill_fifo();
+        pause();
+      }
+
+      tx_queue_[tx_head_++ % tx_queue_size] = s[i];
+    }
+
+    // There is only an interrupt when the FIFO runs empty, so we have to
+    // get the UART going.
+    fill_fifo();
+    tx_lock_.unlock();
+
+    handle_pending();
+  }
+
+  static void tx_interrupt()
+  {
+    auto &self = *interrupt_device_;
+
+    // Reading IIR acknowledges the THRE interrupt.
+    self.in(uart_reg::IIR);
+
+    __atomic_store_n(&self.tx_pending_, true, __ATOMIC_RELEASE);
+    self.handle_pending();
+  }
+
 public:
 
   void putc(char c) override
   {
-    while (not (in(uart_reg::LSR) & LSR_CAN_TX))
-      pause();
+    if (use_interrupts_) {
+      queue(&c, 1);
+      return;
+    }
+
+    // Once the FIFO is empty, we can fill all of it without looking at the
+    // UART again.
+    if (tx_room_ == 0) {
+      while (not (in(uart_reg::LSR) & LSR_CAN_TX))
+        pause();
+
+      tx_room_ = fifo_size_;
+    }
 
     out(uart_reg::THR, (uint8_t)c);
+    tx_room_--;
+  }
+
+  void write(const char *s, size_t length) override
+  {
+    if (use_interrupts_) {
+      queue(s, length);
+      return;
+    }
+
+    for (size_t i = 0; i < length; i++)
+      putc(s[i]);
+  }
+
+  bool enable_interrupts() override
+  {
+    // COM2 and COM4 use IRQ 3, COM1 and COM3 IRQ 4.
+    size_t const irq = (base_port_ & 0xFF00) == 0x200 ? 3 : 4;
+
+    interrupt_device_ = this;
+    use_interrupts_ = true;
+
+    enable_irq(irq, tx_interrupt);
+    out(uart_reg::IER, IER_THRE);
+    out(uart_reg::MCR, MCR_RTS | MCR_DTS | MCR_OUT2);
+
+    sti();
+    return true;
+  }
+
+  void sync() override
+  {
+    if (use_interrupts_) {
+      tx_lock_.lock();
+      while (tx_tail_ != tx_head_) {
+        fill_fifo();
+        pause();
+      }
+      tx_lock_.unlock();
+    }
+
+    while (not (in(uart_reg::LSR) & LSR_TX_IDLE))
+      pause();
+  }
+
+  void configure_serial(uint16_t base_port, uint32_t baud) override
+  {
+    // Setting up the UART clears the FIFO, so we let it finish first.
+    sync();
+
+    if (base_port != 0)
+      base_port_ = base_port;
+
+    setup(baud);
   }
 
   serial_output_device(uint16_t base_port)
     : base_port_(base_port)
   {
-    out(uart_reg::LCR, LCR_DLAB);
-    out(uart_reg::DLL, 1);      // Divisor=1 -> 115200 baud
-    out(uart_reg::DLH, 0);
-
-    out(uart_reg::LCR, LCR_8BITDATA | LCR_1BITSTOP);
-    out(uart_reg::IER, 0);      // Disable all interrupts
-    out(uart_reg::FCR, FCR_ENABLE_FIFO | FCR_CLEAR_RX | FCR_CLEAR_TX);
-    out(uart_reg::MCR, MCR_RTS | MCR_DTS);
+    setup(max_baud);
   }
 };
 
+serial_output_device *serial_output_device::interrupt_device_;
+
+// The BIOS data area has the I/O ports of the serial ports it found. This is
+// zero, if there is none.
+static uint16_t bios_serial_port()
+{
+  uintptr_t addr = 0x400;
+
+  // Keep the compiler from treating a constant address as out-of-bounds
+  // access.
+  asm ("" : "+r" (addr));
+  return *reinterpret_cast<uint16_t const volatile *>(addr);
+}
+
 output_device *output_device::make()
 {
   if (running_virtualized()) {
+    // A virtio console takes a whole buffer per exit, so prefer it, if the
+    // VM has one.
+    if (output_device *virtio_console = make_virtio_console())
+      return virtio_console;
+
     static qemu_output_device qemu_output;
     return &qemu_output;
   }
 
-  static serial_output_device serial_output { 0x3f8 };
+  // This runs early enough that low memory is still identity mapped.
+  uint16_t const port = bios_serial_port();
+
+  static serial_output_device serial_output { port != 0 ? port : (uint16_t)0x3f8 };
   return &serial_output;
 }
@@ -0,0 +1,72 @@
+#include "pci.hpp"
+#include "x86.hpp"
+
+namespace {
+
+enum : uint16_t {
+  PCI_CONFIG_ADDRESS = 0xCF8,
+  PCI_CONFIG_DATA = 0xCFC,
+};
+
+enum : uint8_t {
+  PCI_ID = 0x00,
+  PCI_HEADER = 0x0C,
+};
+
+enum : uint32_t {
+  PCI_CONFIG_ENABLE = 1U << 31,
+
+  // In the header type byte of PCI_HEADER.
+  PCI_HEADER_MULTIFUNCTION = 1U << 23,
+};
+
+}
+
+static uint32_t config_address(pci_address const &address, uint8_t offset)
+{
+  return PCI_CONFIG_ENABLE | (uint32_t)address.bus << 16 |
+    (uint32_t)address.device << 11 | (uint32_t)address.function << 8 | (offset & 0xFC);
+}
+
+uint32_t pci_read_config(pci_address const &address, uint8_t offset)
+{
+  outl(PCI_CONFIG_ADDRESS, config_address(address, offset));
+  return inl(PCI_CONFIG_DATA);
+}
+
+void pci_write_config(pci_address const &address, uint8_t offset, uint32_t value)
+{
+  outl(PCI_CONFIG_ADDRESS, config_address(address, offset));
+  outl(PCI_CONFIG_DATA, value);
+}
+
+bool pci_find_device(uint16_t vendor, uint16_t device, pci_address &res)
+{
+  uint32_t const wanted = (uint32_t)device << 16 | vendor;
+
+  for (unsigned bus = 0; bus < 256; bus++) {
+    for (unsigned dev = 0; dev < 32; dev++) {
+      for (unsigned function = 0; function < 8; function++) {
+        pci_address const address { (uint8_t)bus, (uint8_t)dev, (uint8_t)function };
+        uint32_t const id = pci_read_config(address, PCI_ID);
+
+        // Nothing there.
+        if ((id & 0xFFFF) == 0xFFFF) {
+          if (function == 0)
+            break;
+          continue;
+        }
+
+        if (id == wanted) {
+          res = address;
+          return true;
+        }
+
+        if (function == 0 and not (pci_read_config(address, PCI_HEADER) & PCI_HEADER_MULTIFUNCTION))
+          break;
+      }
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,102 @@
+#include "pic.hpp"
+#include "util.hpp"
+#include "x86.hpp"
+
+namespace {
+
+enum : uint16_t {
+  PIC1_COMMAND = 0x20,
+  PIC1_DATA = 0x21,
+  PIC2_COMMAND = 0xA0,
+  PIC2_DATA = 0xA1,
+};
+
+enum : uint8_t {
+  ICW1_ICW4 = 0x01,
+  ICW1_INIT = 0x10,
+  ICW4_8086 = 0x01,
+
+  OCW3_READ_ISR = 0x0B,
+
+  PIC_EOI = 0x20,
+
+  // The slave PIC is connected to this IRQ of the master.
+  CASCADE_IRQ = 2,
+};
+
+}
+
+static void (*irq_handlers[pic_irq_count])();
+static bool pic_initialized;
+
+// Everything starts out masked.
+static uint16_t irq_mask = 0xFFFF;
+
+static void setup_pic()
+{
+  outb(PIC1_COMMAND, ICW1_INIT | ICW1_ICW4);
+  outb(PIC2_COMMAND, ICW1_INIT | ICW1_ICW4);
+  outb(PIC1_DATA, pic_vector_base);
+  outb(PIC2_DATA, pic_vector_base + 8);
+  outb(PIC1_DATA, 1 << CASCADE_IRQ);
+  outb(PIC2_DATA, CASCADE_IRQ);
+  outb(PIC1_DATA, ICW4_8086);
+  outb(PIC2_DATA, ICW4_8086);
+
+  outb(PIC1_DATA, irq_mask & 0xFF);
+  outb(PIC2_DATA, irq_mask >> 8);
+
+  pic_initialized = true;
+}
+
+void enable_irq(size_t irq, void (*handler)())
+{
+  assert(irq < pic_irq_count and irq != CASCADE_IRQ, "Invalid IRQ");
+
+  if (not pic_initialized)
+    setup_pic();
+
+  irq_handlers[irq] = handler;
+  irq_mask &= ~(1U << irq);
+
+  if (irq >= 8)
+    irq_mask &= ~(1U << CASCADE_IRQ);
+
+  outb(PIC1_DATA, irq_mask & 0xFF);
+  outb(PIC2_DATA, irq_mask >> 8);
+}
+
+// The PICs signal IRQ 7 or 15 when an interrupt goes away before they could
+// deliver it. These spurious interrupts are not in service and must not be
+// acknowledged.
+static bool is_spurious(size_t irq)
+{
+  if (irq != 7 and irq != 15)
+    return false;
+
+  uint16_t const command = irq < 8 ? PIC1_COMMAND : PIC2_COMMAND;
+
+  outb(command, OCW3_READ_ISR);
+  return not (inb(command) & 0x80);
+}
+
+void handle_pic_interrupt(size_t vector)
+{
+  size_t const irq = vector - pic_vector_base;
+
+  assert(irq < pic_irq_count, "Not a PIC interrupt");
+
+  if (is_spurious(irq)) {
+    // The master doesn't know that the slave's interrupt was spurious.
+    if (irq >= 8)
+      outb(PIC1_COMMAND, PIC_EOI);
+    return;
+  }
+
+  if (irq_handlers[irq])
+    irq_handlers[irq]();
+
+  if (irq >= 8)
+    outb(PIC2_COMMAND, PIC_EOI);
+  outb(PIC1_COMMAND, PIC_EOI);
+}
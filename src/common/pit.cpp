@@ -0,0 +1,46 @@
+#include "pit.hpp"
+#include "x86.hpp"
+
+namespace {
+
+enum : uint16_t {
+  PIT_CHANNEL2 = 0x42,
+  PIT_COMMAND = 0x43,
+
+  // The keyboard controller port B controls the channel 2 gate and lets us
+  // read its output.
+  PORT_B = 0x61,
+};
+
+enum : uint8_t {
+  PORT_B_GATE2 = 1 << 0,
+  PORT_B_SPEAKER = 1 << 1,
+  PORT_B_OUT2 = 1 << 5,
+};
+
+}
+
+static const uint32_t pit_frequency = 1193182;
+
+void udelay(uint32_t us)
+{
+  uint64_t ticks = (uint64_t)us * pit_frequency / 1000000;
+
+  // Enable the gate, but keep the speaker quiet.
+  outb(PORT_B, (inb(PORT_B) & ~PORT_B_SPEAKER) | PORT_B_GATE2);
+
+  while (ticks > 0) {
+    uint16_t const count = ticks > 0xFFFF ? 0xFFFF : (uint16_t)ticks;
+
+    // Channel 2, low byte then high byte, mode 0 (interrupt on terminal count).
+    // The output goes high when the count expires.
+    outb(PIT_COMMAND, 0xB0);
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, count >> 8);
+
+    while (not (inb(PORT_B) & PORT_B_OUT2))
+      pause();
+
+    ticks -= count;
+  }
+}
@@ -0,0 +1,213 @@
+#include "arch.hpp"
+#include "mpsc_ring.hpp"
+#include "results.hpp"
+#include "spinlock.hpp"
+#include "util.hpp"
+#include "x86.hpp"
+
+static const size_t result_queue_size = 256;
+
+static mpsc_ring<result_record, result_queue_size> results;
+
+// Whoever holds this writes results to the output device.
+static spinlock drainer_lock;
+
+static void print_bytes(instruction_bytes const &instr, size_t length)
+{
+  for (size_t i = 0; i < length and i < array_size(instr.raw); i++) {
+    format(" ", hex(instr.raw[i], 2, false));
+  }
+}
+
+static void print_verdict(cpu_verdict const &verdict)
+{
+  auto const &attempt = verdict.attempt;
+
+  format(" | CPU ", verdict.cpu, " ", hex(verdict.signature, 8, false), "/",
+         hex(verdict.core_type, 2, false), " EXC ", hex(attempt.exception, 2, false));
+
+  if (attempt.length > sizeof(instruction_bytes::raw))
+    format(" ??");
+  else
+    format(" LEN ", attempt.length);
+}
+
+enum : uint8_t {
+  BINARY_VERSION = 1,
+
+  BINARY_END = 0x0F,
+  BINARY_EXCEPTION_FOLLOWS = 0x0F,
+};
+
+static bool binary_results;
+
+// The previous instruction in binary results.
+static instruction_bytes binary_previous;
+static size_t binary_previous_length;
+
+static void print_binary_instruction(instruction_bytes const &instr,
+                                     execution_attempt const &attempt)
+{
+  size_t const length = attempt.length;
+  size_t shared = 0;
+
+  assert(length >= 1 and length <= sizeof(instr.raw), "Length doesn't fit into a record");
+
+  while (shared < length and shared < binary_previous_length and
+         instr.raw[shared] == binary_previous.raw[shared])
+    shared++;
+
+  char record[3 + sizeof(instr.raw)];
+  size_t size = 0;
+
+  if (attempt.exception < BINARY_EXCEPTION_FOLLOWS) {
+    record[size++] = (char)(length << 4 | attempt.exception);
+  } else {
+    record[size++] = (char)(length << 4 | BINARY_EXCEPTION_FOLLOWS);
+    record[size++] = (char)attempt.exception;
+  }
+
+  record[size++] = (char)shared;
+  for (size_t i = shared; i < length; i++)
+    record[size++] = (char)instr.raw[i];
+
+  print_raw(record, size);
+
+  binary_previous = instr;
+  binary_previous_length = length;
+}
+
+static void print_result(result_record const &record)
+{
+  auto const &instr = record.instr;
+  auto const &attempt = record.found.attempt;
+
+  // Everything else is rare enough to stay text. In binary mode, print() makes
+  // text records out of it.
+  if (binary_results and record.kind == result_kind::instruction) {
+    print_binary_instruction(instr, attempt);
+    return;
+  }
+
+  if (record.kind == result_kind::checkpoint) {
+    auto const &checkpoint = record.checkpoint;
+
+    // This is meant to be pasted as is into the command line.
+    format("CKPT CPU ", record.found.cpu, " | resume=");
+    for (uint8_t byte : checkpoint.current.raw)
+      format(hex(byte, 2, false));
+    format(":", checkpoint.increment_at, ":", checkpoint.base_pos, ":", checkpoint.end,
+           ":", attempt.length, ":", hex(attempt.exception, 2, false), "\n");
+    return;
+  }
+
+  if (record.kind == result_kind::disagreement) {
+    size_t const length = attempt.length > record.checked.attempt.length ?
+      attempt.length : record.checked.attempt.length;
+
+    format("DIFF |");
+    print_bytes(instr, length);
+    print_verdict(record.found);
+    print_verdict(record.checked);
+    format("\n");
+    return;
+  }
+
+  // Prefix instruction, so it's easy to grep output.
+  format("EXC ", hex(attempt.exception, 2, false), " ");
+
+  format(attempt.length >= array_size(instr.raw) ? "??" : "OK");
+
+  format(" |");
+  print_bytes(instr, attempt.length);
+  format("\n");
+}
+
+static void queue_result(result_record &record)
+{
+  // If the queue is full, we help emptying it.
+  while (not results.push(record)) {
+    drain_results();
+    pause();
+  }
+}
+
+void report_result(instruction_bytes const &instr, execution_attempt const &attempt)
+{
+  result_record record {};
+
+  record.instr = instr;
+  record.found.attempt = attempt;
+  record.found.cpu = (uint16_t)get_cpu_index();
+  queue_result(record);
+}
+
+void report_disagreement(instruction_bytes const &instr,
+                         cpu_verdict const &found, cpu_verdict const &checked)
+{
+  result_record record {};
+
+  record.instr = instr;
+  record.found = found;
+  record.kind = result_kind::disagreement;
+  record.checked = checked;
+  queue_result(record);
+}
+
+void report_checkpoint(search_checkpoint const &checkpoint, execution_attempt const &last)
+{
+  result_record record {};
+
+  record.found.attempt = last;
+  record.found.cpu = (uint16_t)get_cpu_index();
+  record.kind = result_kind::checkpoint;
+  record.checkpoint = checkpoint;
+  queue_result(record);
+}
+
+void start_binary_results()
+{
+  char const header[] { 'B', 'S', 'R', BINARY_VERSION };
+
+  format(">>> Binary results follow.\n");
+  print_raw(header, sizeof(header));
+
+  set_binary_output(true);
+  binary_results = true;
+  binary_previous_length = 0;
+}
+
+void end_binary_results()
+{
+  char const end = BINARY_END;
+
+  print_raw(&end, 1);
+  set_binary_output(false);
+  binary_results = false;
+}
+
+void drain_results()
+{
+  if (not drainer_lock.try_lock())
+    return;
+
+  // A producer may be in the middle of writing the oldest record, so we
+  // can't rely on pop() alone to tell us that we are done.
+  result_record record;
+  while (results.size() != 0) {
+    if (results.pop(record))
+      print_result(record);
+    else
+      pause();
+  }
+
+  flush_output();
+  drainer_lock.unlock();
+}
+
+void drain_results_if_needed()
+{
+  // Start before producers have to wait.
+  if (results.size() >= result_queue_size / 2)
+    drain_results();
+}
@@ -0,0 +1,61 @@
+#include "scheduler.hpp"
+#include "arch.hpp"
+#include "util.hpp"
+#include "work_deque.hpp"
+#include "x86.hpp"
+
+// A CPU only offers work when its deque is empty, so there is never much in
+// there.
+static work_deque<search_range, 16> offered_work[max_cpus];
+
+// The number of CPUs that have nothing to do. A CPU that tries to steal work
+// doesn't count as idle, so all CPUs being idle means we are done.
+static size_t idle_cpus;
+
+bool work_wanted()
+{
+  return __atomic_load_n(&idle_cpus, __ATOMIC_RELAXED) > 0 and
+    offered_work[get_cpu_index()].is_empty();
+}
+
+void offer_work(search_range const &range)
+{
+  bool const offered = offered_work[get_cpu_index()].push(range);
+  assert(offered, "Too much work offered");
+}
+
+bool find_work(search_range &range, void (*help_out)())
+{
+  size_t const cpu = get_cpu_index();
+  size_t const cpu_count = get_cpu_count();
+
+  // Take back what nobody has stolen yet.
+  if (offered_work[cpu].pop(range))
+    return true;
+
+  __atomic_add_fetch(&idle_cpus, 1, __ATOMIC_SEQ_CST);
+
+  while (__atomic_load_n(&idle_cpus, __ATOMIC_SEQ_CST) < cpu_count) {
+    for (size_t i = 1; i < cpu_count; i++) {
+      auto &victim = offered_work[(cpu + i) % cpu_count];
+
+      if (victim.is_empty())
+        continue;
+
+      __atomic_sub_fetch(&idle_cpus, 1, __ATOMIC_SEQ_CST);
+      if (victim.steal(range))
+        return true;
+      __atomic_add_fetch(&idle_cpus, 1, __ATOMIC_SEQ_CST);
+    }
+
+    help_out();
+    pause();
+  }
+
+  return false;
+}
+
+void stop_working()
+{
+  __atomic_add_fetch(&idle_cpus, 1, __ATOMIC_SEQ_CST);
+}
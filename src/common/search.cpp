@@ -1,5 +1,4 @@
 #include <cstddef>
-#include <cstring>
 
 #include "search.hpp"
 #include "util.hpp"
@@ -53,100 +52,220 @@ static constexpr prefix_lut create_prefix_group_lut()
 
 static prefix_lut prefix_group_lut {create_prefix_group_lut()};
 
-// Encapsulates which prefixes are there, where and how many there are.
-struct prefix_state {
-  uint8_t count[5] {};          // Count of prefixes in each group.
-  uint8_t position[5] {};       // Position of each prefix (tracked per group)
+struct skip_lut {
+  uint8_t data[max_prefix_groups + 1][256];
+};
+
+// For each smallest acceptable prefix group, map a byte value to the next
+// acceptable byte value that is not smaller. A value of zero means there is no
+// such byte and we need to wrap.
+static constexpr skip_lut create_next_byte_lut()
+{
+  skip_lut lut {};
+
+  for (size_t min_group = 0; min_group < array_size(lut.data); min_group++) {
+    uint8_t next = 0;
 
-  size_t total_prefix_bytes() const
-  {
-    size_t sum = 0;
+    for (size_t i = array_size(lut.data[min_group]); i-- > 0;) {
+      int const group = opcode_to_prefix_group((uint8_t)i);
 
-    for (auto c : count) {
-      sum += c;
+      if (group < 0 or group >= (int)min_group)
+        next = (uint8_t)i;
+
+      lut.data[min_group][i] = next;
     }
+  }
 
-    return sum;
+  return lut;
+}
+
+static skip_lut next_byte_lut {create_next_byte_lut()};
+
+template <size_t MAX_PREFIXES>
+search_engine<MAX_PREFIXES>::search_engine(instruction_bytes const &start)
+  : current_(start)
+{
+  for (size_t i = 0; i < sizeof(current_.raw); i++) {
+    if (current_.raw[i] != 0)
+      increment_at_ = i;
   }
 
-  bool has_duplicated_prefixes() const
-  {
-    for (auto c : count) {
-      if (c >= 2)
-        return true;
-    }
+  while (prefix_bytes_ < sizeof(current_.raw) and
+         prefix_group_lut.data[current_.raw[prefix_bytes_]] >= 0)
+    prefix_bytes_++;
+}
 
-    return false;
+template <size_t MAX_PREFIXES>
+search_engine<MAX_PREFIXES>::search_engine(search_range const &range)
+  : current_(range.start), increment_at_(range.pos), base_pos_(range.pos), end_(range.end)
+{
+  // Like above, we begin incrementing at the last non-zero byte.
+  for (size_t i = range.pos + 1; i < sizeof(current_.raw); i++) {
+    if (current_.raw[i] != 0)
+      increment_at_ = i;
   }
 
-  // We assume no duplicated prefixes here.
-  bool has_ordered_prefixes() const
-  {
-    // TODO There has to be a better way to express this. This also generates an
-    // amazing number of conditional jumps with clang. Maybe use non-short-circuit
-    // boolean operators.
-    for (size_t i = 0; i < array_size(position) - 1; i++)
-      for (size_t j = i + 1; j < array_size(position); j++)
-        // Use non-short-circuit operators to reduce the number of conditional
-        // jumps.
-        if (count[i] and count[j] and (position[i] > position[j]))
-          return false;
-
-    return true;
+  while (prefix_bytes_ < increment_at_ and
+         prefix_group_lut.data[current_.raw[prefix_bytes_]] >= 0)
+    prefix_bytes_++;
+
+  if (current_.raw[base_pos_] >= end_) {
+    empty_ = true;
+    return;
   }
-};
 
-static prefix_state analyze_prefixes(instruction_bytes const &instr)
+  uint8_t const first = current_.raw[increment_at_];
+  uint8_t const byte = set_acceptable_byte(first);
+
+  if (increment_at_ == base_pos_) {
+    empty_ = (byte == 0 and first != 0) or byte >= end_;
+  } else if (byte == 0 and first != 0) {
+    // There is no acceptable byte left at this position, so we continue left
+    // of it.
+    increment_at_--;
+    empty_ = not find_next_candidate();
+  }
+}
+
+template <size_t MAX_PREFIXES>
+search_engine<MAX_PREFIXES>::search_engine(search_checkpoint const &checkpoint)
+  : current_(checkpoint.current), increment_at_(checkpoint.increment_at),
+    base_pos_(checkpoint.base_pos), end_(checkpoint.end)
+{
+  // We only ever look at the prefix bytes before increment_at_, so counting
+  // them again gives the same result.
+  while (prefix_bytes_ < increment_at_ and
+         prefix_group_lut.data[current_.raw[prefix_bytes_]] >= 0)
+    prefix_bytes_++;
+}
+
+template <size_t MAX_PREFIXES>
+bool search_engine<MAX_PREFIXES>::split(search_range &upper)
+{
+  // If there is nothing left at the base position, we are only working on the
+  // subtree below its current byte. So we can move the base to the right.
+  while (base_pos_ < increment_at_ and current_.raw[base_pos_] + 1u >= end_) {
+    base_pos_++;
+    end_ = 256;
+  }
+
+  size_t const from = current_.raw[base_pos_] + 1u;
+  if (from >= end_)
+    return false;
+
+  size_t const mid = from + (end_ - from) / 2;
+
+  upper.start = current_;
+  upper.start.raw[base_pos_] = (uint8_t)mid;
+  for (size_t i = base_pos_ + 1; i < sizeof(upper.start.raw); i++)
+    upper.start.raw[i] = 0;
+  upper.pos = base_pos_;
+  upper.end = end_;
+
+  end_ = mid;
+  return true;
+}
+
+template <size_t MAX_PREFIXES>
+void search_engine<MAX_PREFIXES>::clear_after(size_t pos)
 {
-  prefix_state state;
+  // The bytes up to the base position are fixed.
+  if (pos <= base_pos_)
+    pos = base_pos_ + 1;
+
+  if (pos < sizeof(current_.raw)) {
+    uint64_t words[2];
 
-  for (size_t i = 0; i < sizeof(instr.raw); i++) {
-    int group = prefix_group_lut.data[instr.raw[i]];
-    if (group < 0)
-      break;
+    current_.load_words(words);
+    words[0] &= pos >= 8 ? ~0ULL : (1ULL << (pos * 8)) - 1;
+    words[1] &= pos <= 8 ? 0 : (1ULL << ((pos - 8) * 8)) - 1;
+    current_.store_words(words);
 
-    state.count[group]++;
-    state.position[group] = i;
+    if (prefix_bytes_ > pos)
+      prefix_bytes_ = pos;
   }
+}
 
-  return state;
+template <size_t MAX_PREFIXES>
+void search_engine<MAX_PREFIXES>::start_over(size_t length)
+{
+  // Lengths beyond the maximum instruction length mean that the instruction
+  // was never fetched completely.
+  increment_at_ = (length < sizeof(current_.raw) ? length : sizeof(current_.raw)) - 1;
+
+  // The next increment left of the base position would take us out of our
+  // range. So we increment at the base position instead and let that be the
+  // end.
+  if (increment_at_ < base_pos_) {
+    increment_at_ = base_pos_;
+    end_ = current_.raw[base_pos_] + 1u;
+  }
 }
 
-void search_engine::clear_after(size_t pos)
+// All bytes after increment_at_ are zero, which is not a prefix. So prefixes
+// can only change at increment_at_ and everything before it is the same as in
+// the last accepted candidate.
+//
+// Duplicated prefixes make the search space explode without generating
+// insight. Also enforce order on prefixes to further reduce search space.
+// Together this means prefix groups have to be strictly increasing.
+template <size_t MAX_PREFIXES>
+size_t search_engine<MAX_PREFIXES>::min_prefix_group(size_t prefixes_before) const
 {
-  if (pos < sizeof(current_.raw))
-    memset(current_.raw + pos, 0, sizeof(current_.raw) - pos);
+  size_t const pos = increment_at_;
+
+  // This byte comes after the prefixes, so anything goes.
+  if (prefixes_before < pos)
+    return 0;
+
+  if (pos >= MAX_PREFIXES)
+    return max_prefix_groups;
+
+  return pos == 0 ? 0 : prefix_group_lut.data[current_.raw[pos - 1]] + 1;
 }
 
-void search_engine::start_over(size_t length)
+template <size_t MAX_PREFIXES>
+uint8_t search_engine<MAX_PREFIXES>::set_acceptable_byte(uint8_t from)
 {
-  increment_at_ = length - 1;
+  size_t const pos = increment_at_;
+  uint8_t &byte = current_.raw[pos];
+
+  if (MAX_PREFIXES == 0) {
+    // Without prefixes, only the first byte is restricted.
+    byte = next_byte_lut.data[pos == 0 ? max_prefix_groups : 0][from];
+  } else {
+    size_t const prefixes_before = prefix_bytes_ < pos ? prefix_bytes_ : pos;
+
+    byte = next_byte_lut.data[min_prefix_group(prefixes_before)][from];
+    prefix_bytes_ = (prefixes_before == pos and prefix_group_lut.data[byte] >= 0) ?
+      pos + 1 : prefixes_before;
+  }
+
+  return byte;
 }
 
-bool search_engine::find_next_candidate()
+template <size_t MAX_PREFIXES>
+bool search_engine<MAX_PREFIXES>::find_next_candidate()
 {
  again:
-  current_.raw[increment_at_]++;
+  uint8_t const byte = set_acceptable_byte((uint8_t)(current_.raw[increment_at_] + 1));
 
-  if (current_.raw[increment_at_] == 0) {
+  if (byte == 0 or (increment_at_ == base_pos_ and byte >= end_)) {
     // We've wrapped at our current position, so go left one byte. If we hit
-    // the beginning, we are done.
-    if (unlikely(increment_at_-- == 0)) {
+    // the base position, we are done.
+    if (unlikely(increment_at_-- == base_pos_)) {
       return false;
     }
 
     goto again;
   }
 
-  auto const state = analyze_prefixes(current_);
-
-  // Duplicated prefixes make the search space explode without generating
-  // insight. Also enforce order on prefixes to further reduce search space.
-  if (state.total_prefix_bytes() > max_prefixes_ or
-      state.has_duplicated_prefixes() or
-      not state.has_ordered_prefixes()) {
-    goto again;
-  }
-
   return true;
 }
+
+template class search_engine<0>;
+template class search_engine<1>;
+template class search_engine<2>;
+template class search_engine<3>;
+template class search_engine<4>;
+template class search_engine<5>;
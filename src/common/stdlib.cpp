@@ -39,3 +39,16 @@ int strcmp(const char *s1, const char *s2)
   while ((r = *(s1++) - *(s2++)) == 0 and s1[-1]);
   return r;
 }
+
+int memcmp(const void *s1, const void *s2, size_t n)
+{
+  auto const a = static_cast<const unsigned char *>(s1);
+  auto const b = static_cast<const unsigned char *>(s2);
+
+  for (size_t i = 0; i < n; i++) {
+    if (a[i] != b[i])
+      return a[i] - b[i];
+  }
+
+  return 0;
+}
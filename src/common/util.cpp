@@ -1,3 +1,4 @@
+#include "arch.hpp"
 #include "output_device.hpp"
 #include "util.hpp"
 #include "x86.hpp"
@@ -7,9 +8,121 @@ extern "C" void (*_init_array_end[])();
 
 static output_device * const output_device = output_device::make();
 
+// Each CPU collects what it prints and writes it out in one go, once the
+// buffer is getting full or someone calls flush_output(). We only write out
+// complete lines, unless a line doesn't fit into the buffer. This way, lines
+// from different CPUs don't mix.
+static const size_t output_buffer_size = 4096;
+
+static struct alignas(64) {
+  char data[output_buffer_size];
+  size_t used;
+
+  // The length of the complete lines and raw records in data.
+  size_t lines;
+
+  // In binary mode, whether we are in the middle of a text record.
+  bool in_text;
+} output_buffers[max_cpus];
+
+static bool binary_output;
+
+static void write_out(size_t cpu, size_t length)
+{
+  auto &buffer = output_buffers[cpu];
+
+  output_device->write(buffer.data, length);
+
+  __builtin_memmove(buffer.data, buffer.data + length, buffer.used - length);
+  buffer.used -= length;
+  buffer.lines = 0;
+}
+
+static void put_char(size_t cpu, char c)
+{
+  auto &buffer = output_buffers[cpu];
+
+  if (buffer.used == output_buffer_size)
+    write_out(cpu, buffer.lines != 0 ? buffer.lines : buffer.used);
+
+  buffer.data[buffer.used++] = c;
+}
+
+// Mark everything in the buffer as complete.
+static void end_unit(size_t cpu)
+{
+  auto &buffer = output_buffers[cpu];
+
+  buffer.lines = buffer.used;
+
+  if (buffer.used >= output_buffer_size * 3 / 4)
+    write_out(cpu, buffer.used);
+}
+
+static void print_char(char c)
+{
+  size_t const cpu = get_cpu_index();
+  auto &buffer = output_buffers[cpu];
+
+  if (binary_output and not buffer.in_text) {
+    put_char(cpu, 0);
+    buffer.in_text = true;
+  }
+
+  put_char(cpu, c);
+
+  if (c == '\n') {
+    buffer.in_text = false;
+    end_unit(cpu);
+  }
+}
+
+void flush_output()
+{
+  size_t const cpu = get_cpu_index();
+
+  write_out(cpu, output_buffers[cpu].used);
+}
+
+void sync_output()
+{
+  flush_output();
+  output_device->sync();
+}
+
+bool enable_output_interrupts()
+{
+  return output_device->enable_interrupts();
+}
+
+void configure_serial_output(uint16_t port, uint32_t baud)
+{
+  // Anything that is still buffered goes to the new port.
+  output_device->configure_serial(port, baud);
+}
+
+void print_raw(const char *data, size_t length)
+{
+  size_t const cpu = get_cpu_index();
+
+  for (size_t i = 0; i < length; i++)
+    put_char(cpu, data[i]);
+
+  // Raw data doesn't come in lines, so we keep it together like a line. A
+  // newline in it doesn't end anything.
+  end_unit(cpu);
+}
+
+void set_binary_output(bool on)
+{
+  binary_output = on;
+}
+
 void print(const char *str)
 {
-  output_device->puts(str);
+  char c;
+  while ((c = *(str++)) != 0)
+    print_char(c);
 }
 
 __attribute__((noinline)) void print(formatted_int const &v)
@@ -35,7 +148,7 @@ __attribute__((noinline)) void print(formatted_int const &v)
     print("0x");
 
   do {
-    output_device->putc(*(--p));
+    print_char(*(--p));
   } while (p != output);
 }
 
@@ -47,6 +160,9 @@ void fail_assert(const char *s)
 
 void wait_forever()
 {
+  // This is the last chance to get out what we wanted to say.
+  sync_output();
+
   while (true)
     asm volatile ("cli ; hlt");
 }
@@ -0,0 +1,218 @@
+#include <cstring>
+
+#include "pci.hpp"
+#include "spinlock.hpp"
+#include "util.hpp"
+#include "virtio_console.hpp"
+#include "x86.hpp"
+
+namespace {
+
+enum : uint16_t {
+  VIRTIO_VENDOR = 0x1AF4,
+
+  // The transitional device ID of the console.
+  VIRTIO_CONSOLE_DEVICE = 0x1003,
+};
+
+enum : uint8_t {
+  PCI_COMMAND = 0x04,
+  PCI_BAR0 = 0x10,
+};
+
+enum : uint32_t {
+  PCI_COMMAND_IO = 1U << 0,
+  PCI_COMMAND_BUS_MASTER = 1U << 2,
+
+  PCI_BAR_IO = 1U << 0,
+};
+
+// Registers of the legacy interface relative to BAR0.
+enum : uint16_t {
+  VIRTIO_GUEST_FEATURES = 0x04,
+  VIRTIO_QUEUE_PFN = 0x08,
+  VIRTIO_QUEUE_SIZE = 0x0C,
+  VIRTIO_QUEUE_SELECT = 0x0E,
+  VIRTIO_QUEUE_NOTIFY = 0x10,
+  VIRTIO_STATUS = 0x12,
+};
+
+enum : uint8_t {
+  STATUS_ACKNOWLEDGE = 1,
+  STATUS_DRIVER = 2,
+  STATUS_DRIVER_OK = 4,
+  STATUS_FAILED = 128,
+};
+
+enum : uint16_t {
+  // Without the multiport feature, the console has a receive queue and this
+  // transmit queue.
+  TRANSMIT_QUEUE = 1,
+
+  VRING_AVAIL_F_NO_INTERRUPT = 1,
+};
+
+struct vring_desc {
+  uint64_t addr;
+  uint32_t len;
+  uint16_t flags;
+  uint16_t next;
+};
+
+struct vring_used_elem {
+  uint32_t id;
+  uint32_t len;
+};
+
+}
+
+// The legacy interface has the queue size fixed by the device and wants the
+// used ring on the next page after the descriptors and the available ring.
+static constexpr size_t max_queue_size = 256;
+static constexpr size_t vring_page = 4096;
+
+static constexpr size_t align_page(size_t v)
+{
+  return (v + vring_page - 1) & ~(vring_page - 1);
+}
+
+static constexpr size_t vring_bytes(size_t queue_size)
+{
+  return align_page(sizeof(vring_desc) * queue_size + sizeof(uint16_t) * (3 + queue_size)) +
+    align_page(sizeof(vring_used_elem) * queue_size + sizeof(uint16_t) * 3);
+}
+
+class virtio_console_output_device : public output_device {
+  uint16_t io_base_ = 0;
+  uint16_t queue_size_ = 0;
+
+  // Point into vring_.
+  vring_desc *desc_ = nullptr;
+  uint16_t *avail_ = nullptr;
+  uint16_t const *used_ = nullptr;
+
+  uint16_t avail_idx_ = 0;
+
+  // There is only ever one buffer in flight and we wait for the device to
+  // consume it, so a few large buffers keep notifications rare.
+  static constexpr size_t buffer_size = 16384;
+
+  spinlock lock_;
+
+  alignas(vring_page) uint8_t vring_[vring_bytes(max_queue_size)];
+  char buffer_[buffer_size];
+
+  // Memory is identity mapped, so the device sees our buffers at the same
+  // address.
+  static uint64_t physical(void const *p)
+  {
+    return (uintptr_t)p;
+  }
+
+  uint16_t used_idx() const
+  {
+    return __atomic_load_n(&used_[1], __ATOMIC_ACQUIRE);
+  }
+
+  void submit(const char *s, size_t length)
+  {
+    memcpy(buffer_, s, length);
+
+    desc_[0] = { physical(buffer_), (uint32_t)length, 0, 0 };
+    avail_[2 + avail_idx_ % queue_size_] = 0;
+
+    // The device must see the descriptor before the index and the index
+    // before the notification.
+    __atomic_store_n(&avail_[1], ++avail_idx_, __ATOMIC_RELEASE);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    outw(io_base_ + VIRTIO_QUEUE_NOTIFY, TRANSMIT_QUEUE);
+
+    while (used_idx() != avail_idx_)
+      pause();
+  }
+
+public:
+
+  void putc(char c) override
+  {
+    write(&c, 1);
+  }
+
+  void puts(const char *s) override
+  {
+    write(s, strlen(s));
+  }
+
+  void write(const char *s, size_t length) override
+  {
+    lock_.lock();
+
+    while (length > 0) {
+      size_t const chunk = length < buffer_size ? length : buffer_size;
+
+      submit(s, chunk);
+      s += chunk;
+      length -= chunk;
+    }
+
+    lock_.unlock();
+  }
+
+  // Returns false, if the device is not usable.
+  bool setup(pci_address const &address)
+  {
+    uint32_t const bar = pci_read_config(address, PCI_BAR0);
+
+    if (not (bar & PCI_BAR_IO))
+      return false;
+
+    io_base_ = (uint16_t)(bar & ~3U);
+
+    // Leave the upper half alone, because the status bits there are cleared
+    // by writing ones.
+    uint32_t const command = pci_read_config(address, PCI_COMMAND) & 0xFFFF;
+    pci_write_config(address, PCI_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    // Reset and then introduce ourselves. We don't need any features.
+    outb(io_base_ + VIRTIO_STATUS, 0);
+    outb(io_base_ + VIRTIO_STATUS, STATUS_ACKNOWLEDGE);
+    outb(io_base_ + VIRTIO_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+    outl(io_base_ + VIRTIO_GUEST_FEATURES, 0);
+
+    outw(io_base_ + VIRTIO_QUEUE_SELECT, TRANSMIT_QUEUE);
+    queue_size_ = inw(io_base_ + VIRTIO_QUEUE_SIZE);
+
+    if (queue_size_ == 0 or queue_size_ > max_queue_size) {
+      outb(io_base_ + VIRTIO_STATUS, STATUS_FAILED);
+      return false;
+    }
+
+    size_t const avail_offset = sizeof(vring_desc) * queue_size_;
+    size_t const used_offset = align_page(avail_offset + sizeof(uint16_t) * (3 + queue_size_));
+
+    memset(vring_, 0, sizeof(vring_));
+    desc_ = reinterpret_cast<vring_desc *>(vring_);
+    avail_ = reinterpret_cast<uint16_t *>(vring_ + avail_offset);
+    used_ = reinterpret_cast<uint16_t const *>(vring_ + used_offset);
+
+    // We poll the used ring.
+    avail_[0] = VRING_AVAIL_F_NO_INTERRUPT;
+
+    outl(io_base_ + VIRTIO_QUEUE_PFN, (uint32_t)(physical(vring_) / vring_page));
+    outb(io_base_ + VIRTIO_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+    return true;
+  }
+};
+
+output_device *make_virtio_console()
+{
+  static virtio_console_output_device virtio_console;
+  pci_address address;
+
+  if (not pci_find_device(VIRTIO_VENDOR, VIRTIO_CONSOLE_DEVICE, address) or
+      not virtio_console.setup(address))
+    return nullptr;
+
+  return &virtio_console;
+}
@@ -6,6 +6,7 @@
 EXTERN_C void *memset(void *s, int c, size_t n);
 EXTERN_C void *memcpy(void * __restrict__ d, const void * __restrict__ s, size_t n);
 EXTERN_C void *memmove(void *dest, const void *src, size_t n);
+EXTERN_C int memcmp(const void *s1, const void *s2, size_t n);
 EXTERN_C char *strncpy(char *dest, const char *src, size_t n);
 EXTERN_C size_t strlen(const char *s);
 EXTERN_C int strcmp(const char *s1, const char *s2);
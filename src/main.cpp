@@ -6,47 +6,172 @@
 #include "cpuid.hpp"
 #include "execution_attempt.hpp"
 #include "logo.hpp"
+#include "mpsc_ring.hpp"
+#include "nvram.hpp"
+#include "results.hpp"
+#include "scheduler.hpp"
 #include "search.hpp"
 #include "util.hpp"
 #include "x86.hpp"
 #include "cpu_features.hpp"
+#include "fpu.hpp"
 
-static execution_attempt find_instruction_length(cpu_features const &features,
-						 instruction_bytes const &instr)
+static_assert(user_page_count == sizeof(instruction_bytes::raw),
+              "Need one user page per instruction length");
+
+// The address where an instruction of the given length starts. User page
+// len - 1 holds the candidate truncated to len bytes right before its end.
+static uintptr_t probe_ip(size_t len)
+{
+  return get_user_page(len - 1) + page_size - len;
+}
+
+// Write the candidate truncated to every possible length into the user pages.
+// Consecutive candidates usually differ in very few bytes, so we only update
+// what changed since the last call.
+static void lay_out_candidate(instruction_bytes const &instr)
+{
+  // The user pages start out zeroed. Every CPU has its own user pages and its
+  // own cache line here.
+  static struct alignas(64) {
+    instruction_bytes bytes;
+  } laid_out_per_cpu[max_cpus];
+
+  instruction_bytes &laid_out = laid_out_per_cpu[get_cpu_index()].bytes;
+
+  uint64_t now[2], before[2];
+  instr.load_words(now);
+  laid_out.load_words(before);
+
+  for (size_t w = 0; w < array_size(now); w++) {
+    for (uint64_t diff = now[w] ^ before[w]; diff != 0;) {
+      size_t const shift = __builtin_ctzll(diff) & ~7;
+      size_t const i = w * 8 + shift / 8;
+
+      // Byte i is part of every truncated copy that is longer than i bytes.
+      for (size_t len = i + 1; len <= sizeof(instr.raw); len++)
+        get_user_page_backing(len - 1)[page_size - len + i] = instr.raw[i];
+
+      diff &= ~(0xFFULL << shift);
+    }
+  }
+
+  laid_out = instr;
+}
+
+// Execute the candidate truncated to len bytes at the end of its user page.
+// The candidate must have been laid out with lay_out_candidate(). Returns
+// true, if the CPU could not fetch the complete instruction.
+static bool probe_instruction(cpu_features const &features, size_t len,
+                              user_result &res)
+{
+  uintptr_t const guest_ip = probe_ip(len);
+
+  select_user_page(len - 1);
+  res = execute_user(guest_ip);
+
+  // The instruction hasn't been completely fetched, if we get an instruction
+  // fetch page fault from userspace.
+  //
+  // The check for RIP is necessary, because otherwise we cannot correctly
+  // guess the length of XBEGIN with an abort address following the XBEGIN
+  // instruction.
+
+  mword_t const pt_exc_instr = features.has_nx ? EXC_PF_ERR_I : 0;
+  mword_t const pt_exc_mask = EXC_PF_ERR_P | EXC_PF_ERR_U | pt_exc_instr;
+  mword_t const pt_exc_expect = EXC_PF_ERR_U | pt_exc_instr;
+
+  return res.vector == 14 and
+    (res.error_code & pt_exc_mask) == pt_exc_expect and
+    res.cr2 == get_user_page(len - 1) + page_size and
+    res.ip == guest_ip;
+}
+
+// The reference length engine: try every length from 1 upwards until the
+// instruction is fetched completely.
+static execution_attempt find_instruction_length_linear(cpu_features const &features,
+                                                        instruction_bytes const &instr)
 {
-  exception_frame ef;
+  user_result res;
   size_t i;
 
+  lay_out_candidate(instr);
+
   for (i = 1; i <= array_size(instr.raw); i++) {
-    size_t const page_offset =  page_size - i;
-    char * const instr_start = get_user_page_backing() + page_offset;
-    uintptr_t const guest_ip = get_user_page() + page_offset;
-    memcpy(instr_start, instr.raw, i);
-
-    ef = execute_user(guest_ip);
-
-    // The instruction hasn't been completely fetched, if we get an instruction
-    // fetch page fault from userspace.
-    //
-    // The check for RIP is necessary, because otherwise we cannot correctly
-    // guess the length of XBEGIN with an abort address following the XBEGIN
-    // instruction.
-
-    mword_t const pt_exc_instr = features.has_nx ? EXC_PF_ERR_I : 0;
-    mword_t const pt_exc_mask = EXC_PF_ERR_P | EXC_PF_ERR_U | pt_exc_instr;
-    mword_t const pt_exc_expect = EXC_PF_ERR_U | pt_exc_instr;
-
-    bool const incomplete_instruction_fetch =
-      ef.vector == 14 and
-      (ef.error_code & pt_exc_mask) == pt_exc_expect and
-      get_cr2() == get_user_page() + page_size and
-      ef.ip == guest_ip;
-
-    if (not incomplete_instruction_fetch)
+    if (not probe_instruction(features, i, res))
       break;
   }
 
-  return { (uint8_t)i, (uint8_t)ef.vector };
+  return { (uint8_t)i, (uint8_t)res.vector };
+}
+
+// Find the instruction length by narrowing down the range between the longest
+// length that could not be fetched completely and the shortest length that
+// could. This works, because the incomplete fetch predicate is monotone in the
+// length.
+//
+// We start at the hint (usually the length of the previous candidate). If the
+// hint is too short, we try a full-length placement next. If a probe runs to
+// completion and single-steps, the RIP delta predicts the length for any
+// instruction that doesn't transfer control. We confirm the prediction by
+// probing both sides of it. This is necessary, because a relative jump can
+// land anywhere in the probe window (think EB 01 or EB FF). Without a
+// prediction, we gallop downwards from the shortest complete length or bisect.
+//
+// The result is identical to find_instruction_length_linear().
+static execution_attempt find_instruction_length(cpu_features const &features,
+                                                 instruction_bytes const &instr,
+                                                 size_t hint)
+{
+  size_t const max_length = array_size(instr.raw);
+
+  // lo is the longest length known to be incomplete, hi the shortest length
+  // known to be complete.
+  size_t lo = 0;
+  size_t hi = max_length + 1;
+  user_result lo_res {}, hi_res {};
+
+  // The length predicted by the RIP delta of the last complete probe or zero.
+  size_t predicted = 0;
+
+  auto const probe = [&] (size_t len) {
+    user_result res;
+
+    if (probe_instruction(features, len, res)) {
+      lo = len;
+      lo_res = res;
+      return;
+    }
+
+    uintptr_t const guest_ip = probe_ip(len);
+
+    hi = len;
+    hi_res = res;
+    predicted = (res.vector == 1 and res.ip > guest_ip and res.ip - guest_ip <= len) ?
+      res.ip - guest_ip : 0;
+  };
+
+  lay_out_candidate(instr);
+  probe(hint < 1 ? 1 : (hint > max_length ? max_length : hint));
+
+  if (hi > max_length and lo < max_length)
+    probe(max_length);
+
+  for (size_t step = 1; hi - lo > 1;) {
+    if (predicted > lo and predicted < hi) {
+      probe(predicted);
+    } else if (predicted == hi) {
+      probe(hi - 1);
+    } else if (lo == 0) {
+      probe(hi > step + 1 ? hi - step : 1);
+      step *= 2;
+    } else {
+      probe(lo + (hi - lo) / 2);
+    }
+  }
+
+  user_result const &res = hi <= max_length ? hi_res : lo_res;
+  return { (uint8_t)hi, (uint8_t)res.vector };
 }
 
 static void self_test_instruction_length(cpu_features const &features)
@@ -60,6 +185,8 @@ static void self_test_instruction_length(cpu_features const &features)
     { 2, { 0xCD, 0x01 } },      // int 0x01
     { 2, { 0x00, 0x00 } },      // add [rax], al
     { 2, { 0xEB, 00 } },        // jmp 0x2
+    { 2, { 0xEB, 0x01 } },      // jmp 0x3
+    { 2, { 0xEB, 0xFF } },      // jmp 0x1
     { 5, { 0xE9, 0x00, 0x00, 0x00, 0x00 } }, // jmp 0x5
 #ifdef __x86_64__
 
@@ -88,10 +215,19 @@ static void self_test_instruction_length(cpu_features const &features)
   bool success = true;
 
   for (auto const &test : tests) {
-    auto attempt = find_instruction_length(features, test.instr);
+    auto attempt = find_instruction_length_linear(features, test.instr);
     if (attempt.length != test.length) {
       success = false;
     }
+
+    // The search engine has to agree with the linear one regardless of where
+    // it starts searching.
+    size_t const hints[] { 1, test.length, array_size(test.instr.raw) };
+    for (size_t hint : hints) {
+      if (find_instruction_length(features, test.instr, hint) != attempt) {
+        success = false;
+      }
+    }
   }
 
   format("Instruction length: ", (success ? "OK" : "b0rken!"), "\n");
@@ -100,22 +236,6 @@ static void self_test_instruction_length(cpu_features const &features)
   }
 }
 
-static void print_instruction(instruction_bytes const &instr,
-                              execution_attempt const &attempt)
-{
-  // Prefix instruction, so it's easy to grep output.
-  format("EXC ", hex(attempt.exception, 2, false), " ");
-
-  format(attempt.length >= array_size(instr.raw) ? "??" : "OK");
-
-  format(" |");
-  for (size_t i = 0; i < attempt.length and i < array_size(instr.raw); i++) {
-    format(" ", hex(instr.raw[i], 2, false));
-  }
-
-  format("\n");
-}
-
 static bool is_interesting_change(execution_attempt const &last,
                                   execution_attempt const &now)
 {
@@ -133,15 +253,225 @@ static bool is_interesting_change(execution_attempt const &last,
   return true;
 }
 
+// How many candidates we execute ahead of the search engine. See start().
+static const size_t speculation_depth = 16;
+
 struct options {
   // We allow this many prefixes. Limiting prefixes is useful, because
   // they make the search space explode.
   size_t prefixes = 0;
 
-  // After how many instructions do we stop. Zero means don't stop.
+  // After how many instructions do we stop. This counts for each CPU
+  // separately. Zero means don't stop.
   size_t stop_after = 0;
+
+  // On how many CPUs do we sift. Zero means all of them.
+  size_t cpus = 0;
+
+  // Let user space execute FPU/SSE/AVX instructions instead of having them
+  // raise #NM.
+  bool user_fpu = false;
+
+  // Enter user space via SYSRET, if that is faster. See enable_sysret_entry().
+  bool sysret = false;
+
+  // Execute every interesting instruction on a second CPU and only report
+  // where they disagree.
+  bool differential = false;
+
+  // Only search candidates from start on and stop before end, if there is
+  // one.
+  instruction_bytes start {};
+  instruction_bytes end {};
+  bool has_end = false;
+
+  // Print a checkpoint after about this many execution attempts on each CPU.
+  // Zero means never.
+  size_t checkpoint_every = 0;
+
+  // Continue the search from a checkpoint instead of starting at the start
+  // cursor.
+  bool has_resume = false;
+  search_checkpoint resume {};
+  execution_attempt resume_last {};
+
+  // Also keep checkpoints in CMOS NVRAM and resume from there after a reset.
+  bool nvram = false;
+
+  // Print results in a compact binary format. See start_binary_results().
+  bool binary = false;
+
+  // The serial port and its baud rate. A zero port means the one the BIOS
+  // found first.
+  uint16_t serial_port = 0;
+  uint32_t serial_baud = 115200;
+
+  // Drive serial output with the UART's transmit interrupt on the boot CPU.
+  bool serial_irq = false;
+
+  // Instead of sifting, print start and end cursors for this many shards of
+  // about equal cost. Every subtree is sampled with plan_samples random
+  // paths.
+  size_t plan = 0;
+  size_t plan_samples = 16;
 };
 
+static int hex_digit_value(char c)
+{
+  if (c >= '0' and c <= '9') return c - '0';
+  if (c >= 'a' and c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' and c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Parse a cursor into the search space given as hex bytes, e.g. 0F38. Returns
+// false, if it is malformed.
+static bool parse_cursor(const char *value, instruction_bytes &cursor)
+{
+  instruction_bytes res {};
+  size_t const length = strlen(value);
+
+  if (length == 0 or length % 2 != 0 or length / 2 > sizeof(res.raw))
+    return false;
+
+  for (size_t i = 0; i < length / 2; i++) {
+    int const hi = hex_digit_value(value[2 * i]);
+    int const lo = hex_digit_value(value[2 * i + 1]);
+
+    if (hi < 0 or lo < 0)
+      return false;
+
+    res.raw[i] = (uint8_t)(hi << 4 | lo);
+  }
+
+  cursor = res;
+  return true;
+}
+
+// Parse a hexadecimal number without prefix. Returns false, if it is
+// malformed.
+static bool parse_hex(const char *value, uint64_t &res)
+{
+  uint64_t v = 0;
+
+  if (*value == 0 or strlen(value) > 16)
+    return false;
+
+  for (; *value; value++) {
+    int const digit = hex_digit_value(*value);
+
+    if (digit < 0)
+      return false;
+
+    v = v << 4 | (uint64_t)digit;
+  }
+
+  res = v;
+  return true;
+}
+
+// The UART can only divide its 115200 baud clock by whole numbers.
+static bool parse_baud(const char *value, options &options)
+{
+  int const baud = atoi(value);
+
+  if (baud <= 0 or baud > 115200 or 115200 % baud != 0)
+    return false;
+
+  options.serial_baud = baud;
+  return true;
+}
+
+// Print a cursor in the format parse_cursor() understands.
+static void print_cursor(instruction_bytes const &cursor)
+{
+  size_t length = 1;
+
+  for (size_t i = 0; i < sizeof(cursor.raw); i++) {
+    if (cursor.raw[i] != 0)
+      length = i + 1;
+  }
+
+  for (size_t i = 0; i < length; i++)
+    format(hex(cursor.raw[i], 2, false));
+}
+
+// Parse a shard specification of the form i/n. Shard i of n covers the first
+// bytes from 256 * i / n up to 256 * (i + 1) / n.
+static bool parse_shard(const char *value, options &options)
+{
+  const char *slash = value;
+
+  while (*slash != 0 and *slash != '/')
+    slash++;
+
+  if (*slash != '/')
+    return false;
+
+  int const index = atoi(value);
+  int const count = atoi(slash + 1);
+
+  if (count < 1 or count > 256 or index < 0 or index >= count)
+    return false;
+
+  options.start = { (uint8_t)(256 * index / count) };
+  options.end = { (uint8_t)(256 * (index + 1) / count) };
+  options.has_end = index + 1 < count;
+  return true;
+}
+
+// Parse the value of a checkpoint as report_checkpoint() prints it. Returns
+// false, if it is malformed.
+static bool parse_resume(const char *value, options &options)
+{
+  char buf[128];
+  size_t const length = strlen(value);
+
+  if (length >= sizeof(buf))
+    return false;
+
+  memcpy(buf, value, length + 1);
+
+  char *state = nullptr;
+  const char *fields[6];
+  size_t field_count = 0;
+
+  for (char *field = strtok_r(buf, ":", &state); field;
+       field = strtok_r(nullptr, ":", &state)) {
+    if (field_count == array_size(fields))
+      return false;
+    fields[field_count++] = field;
+  }
+
+  search_checkpoint checkpoint;
+
+  if (field_count != array_size(fields) or
+      strlen(fields[0]) != 2 * sizeof(checkpoint.current.raw) or
+      not parse_cursor(fields[0], checkpoint.current))
+    return false;
+
+  checkpoint.increment_at = atoi(fields[1]);
+  checkpoint.base_pos = atoi(fields[2]);
+  checkpoint.end = atoi(fields[3]);
+
+  int const last_length = atoi(fields[4]);
+  int const exc_hi = hex_digit_value(fields[5][0]);
+  int const exc_lo = exc_hi < 0 ? -1 : hex_digit_value(fields[5][1]);
+
+  if (checkpoint.increment_at >= sizeof(checkpoint.current.raw) or
+      checkpoint.base_pos > checkpoint.increment_at or
+      checkpoint.current.raw[checkpoint.base_pos] >= checkpoint.end or
+      checkpoint.end > 256 or
+      last_length < 0 or last_length > 16 or
+      exc_lo < 0 or fields[5][2] != 0)
+    return false;
+
+  options.resume = checkpoint;
+  options.resume_last = { (uint8_t)last_length, (uint8_t)(exc_hi << 4 | exc_lo) };
+  options.has_resume = true;
+  return true;
+}
+
 // This will modify cmdline.
 static options parse_and_destroy_cmdline(char *cmdline)
 {
@@ -160,19 +490,679 @@ static options parse_and_destroy_cmdline(char *cmdline)
       res.prefixes = atoi(value);
     if (strcmp(key, "stop_after") == 0)
       res.stop_after = atoi(value);
+    if (strcmp(key, "user_fpu") == 0)
+      res.user_fpu = atoi(value);
+    if (strcmp(key, "cpus") == 0)
+      res.cpus = atoi(value);
+    if (strcmp(key, "sysret") == 0)
+      res.sysret = atoi(value);
+    if (strcmp(key, "differential") == 0)
+      res.differential = atoi(value);
+    if (strcmp(key, "start") == 0) {
+      instruction_bytes start;
+
+      if (parse_cursor(value, start))
+        res.start = start;
+      else
+        format(">>> Ignoring malformed start cursor.\n");
+    }
+    if (strcmp(key, "end") == 0) {
+      instruction_bytes end;
+
+      if (parse_cursor(value, end)) {
+        res.end = end;
+        res.has_end = true;
+      } else {
+        format(">>> Ignoring malformed end cursor.\n");
+      }
+    }
+    if (strcmp(key, "shard") == 0 and not parse_shard(value, res))
+      format(">>> Ignoring malformed shard.\n");
+    if (strcmp(key, "checkpoint_every") == 0)
+      res.checkpoint_every = atoi(value);
+    if (strcmp(key, "resume") == 0 and not parse_resume(value, res))
+      format(">>> Ignoring malformed checkpoint.\n");
+    if (strcmp(key, "nvram") == 0)
+      res.nvram = atoi(value);
+    if (strcmp(key, "binary") == 0)
+      res.binary = atoi(value);
+    if (strcmp(key, "serial_port") == 0) {
+      uint64_t port;
+
+      if (parse_hex(value, port) and port != 0 and port <= 0xFFF8)
+        res.serial_port = (uint16_t)port;
+      else
+        format(">>> Ignoring malformed serial port.\n");
+    }
+    if (strcmp(key, "serial_baud") == 0 and not parse_baud(value, res))
+      format(">>> Ignoring unsupported baud rate.\n");
+    if (strcmp(key, "serial_irq") == 0)
+      res.serial_irq = atoi(value);
+    if (strcmp(key, "plan") == 0)
+      res.plan = atoi(value);
+    if (strcmp(key, "plan_samples") == 0)
+      res.plan_samples = atoi(value);
   }
 
   return res;
 }
 
+// Shard planning
+//
+// We model the search as a tree. The children of a node are all candidates
+// that differ from it in the byte after its prefix. The search only descends
+// into a child, if the child is an interesting change compared to its left
+// sibling and the instruction is longer than the prefix. We estimate the size
+// of a subtree like Knuth: walk down a random path and multiply the number of
+// children we see on each level.
+
+static uint64_t saturating_add(uint64_t a, uint64_t b)
+{
+  uint64_t res;
+  return __builtin_add_overflow(a, b, &res) ? ~0ULL : res;
+}
+
+static uint64_t saturating_mul(uint64_t a, uint64_t b)
+{
+  uint64_t res;
+  return __builtin_mul_overflow(a, b, &res) ? ~0ULL : res;
+}
+
+// A random number generator that is seeded by the subtree it samples. This
+// way, sampling the same subtree twice gives the same estimate.
+class subtree_random {
+  uint64_t state_;
+
+public:
+
+  subtree_random(instruction_bytes const &node, size_t pos)
+  {
+    uint64_t words[2];
+    node.load_words(words);
+    state_ = (words[0] * 0x9E3779B97F4A7C15ULL) ^ words[1] ^ (pos + 1);
+  }
+
+  uint64_t next()
+  {
+    // xorshift64
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 7;
+    state_ ^= state_ << 17;
+    return state_;
+  }
+};
+
+// Execute the children of a node in search order. The children differ in the
+// byte at pos. Calls fn(child, descends) for each.
+template <size_t MAX_PREFIXES, typename FN>
+static void for_each_child(cpu_features const &features, instruction_bytes const &node,
+                           size_t pos, FN fn)
+{
+  search_engine<MAX_PREFIXES> search(search_range { node, pos, 256 });
+  execution_attempt last;
+
+  if (search.is_empty())
+    return;
+
+  do {
+    auto const &child = search.get_candidate();
+    auto const attempt = find_instruction_length(features, child, last.length);
+
+    fn(child, is_interesting_change(last, attempt) and
+       attempt.length > pos + 1 and attempt.length <= sizeof(child.raw));
+    last = attempt;
+  } while (search.find_next_candidate());
+}
+
+// Estimate how many candidates the search executes below a node whose
+// children differ in the byte at pos.
+template <size_t MAX_PREFIXES>
+static uint64_t estimate_subtree(cpu_features const &features, instruction_bytes const &node,
+                                 size_t pos, size_t samples)
+{
+  subtree_random random(node, pos);
+  uint64_t sum = 0;
+
+  for (size_t i = 0; i < samples; i++) {
+    instruction_bytes current = node;
+    uint64_t estimate = 0;
+    uint64_t weight = 1;
+
+    for (size_t p = pos; p < sizeof(current.raw); p++) {
+      size_t children = 0;
+      size_t descending = 0;
+      instruction_bytes chosen;
+
+      // Pick one of the descending children with equal probability.
+      for_each_child<MAX_PREFIXES>(features, current, p,
+                                   [&] (instruction_bytes const &child, bool descends) {
+                                     children++;
+                                     if (descends and random.next() % ++descending == 0)
+                                       chosen = child;
+                                   });
+
+      estimate = saturating_add(estimate, saturating_mul(weight, children));
+      if (descending == 0)
+        break;
+
+      weight = saturating_mul(weight, descending);
+      current = chosen;
+    }
+
+    sum = saturating_add(sum, estimate);
+  }
+
+  return samples ? sum / samples : 0;
+}
+
+// Estimate the cost of all children of a node and call fn(child, cost) for
+// each in search order.
+template <size_t MAX_PREFIXES, typename FN>
+static void estimate_children(cpu_features const &features, instruction_bytes const &node,
+                              size_t pos, size_t samples, FN fn)
+{
+  for_each_child<MAX_PREFIXES>(features, node, pos,
+                               [&] (instruction_bytes const &child, bool descends) {
+                                 uint64_t const below = descends ?
+                                   estimate_subtree<MAX_PREFIXES>(features, child, pos + 1, samples) : 0;
+
+                                 fn(child, saturating_add(1, below));
+                               });
+}
+
+// Cut the search space into shards of about equal estimated cost. We cut
+// between first bytes and split first bytes that are too expensive for a
+// single shard between their second bytes.
+template <size_t MAX_PREFIXES>
+static void plan_shards(cpu_features const &features, size_t shards, size_t samples)
+{
+  uint64_t first_byte_cost[256] {};
+  uint64_t total = 0;
+
+  estimate_children<MAX_PREFIXES>(features, {}, 0, samples,
+                                  [&] (instruction_bytes const &child, uint64_t cost) {
+                                    first_byte_cost[child.raw[0]] = cost;
+                                    total = saturating_add(total, cost);
+                                  });
+
+  // A finer estimate of the expensive first bytes. This samples each of
+  // their children, so it replaces the coarse estimate.
+  uint64_t const coarse_target = total / shards;
+  bool refined[256] {};
+
+  total = 0;
+  for (size_t b = 0; b < 256; b++) {
+    if (first_byte_cost[b] > coarse_target and first_byte_cost[b] > 1) {
+      uint64_t cost = 1;
+
+      estimate_children<MAX_PREFIXES>(features, { (uint8_t)b }, 1, samples,
+                                      [&] (instruction_bytes const &, uint64_t child_cost) {
+                                        cost = saturating_add(cost, child_cost);
+                                      });
+
+      first_byte_cost[b] = cost;
+      refined[b] = true;
+    }
+
+    total = saturating_add(total, first_byte_cost[b]);
+  }
+
+  // Greedily close a shard once it has its fair share of what is left.
+  size_t shard = 0;
+  uint64_t consumed = 0;
+  uint64_t in_shard = 0;
+  instruction_bytes shard_start {};
+
+  auto const add = [&] (instruction_bytes const &cursor, uint64_t cost) {
+    if (in_shard != 0 and shard + 1 < shards and
+        in_shard >= (total - (consumed - in_shard)) / (shards - shard)) {
+      format(">>> Shard ", shard, "/", shards, ": start=");
+      print_cursor(shard_start);
+      format(" end=");
+      print_cursor(cursor);
+      format(" (about ", in_shard, " candidates)\n");
+
+      shard++;
+      in_shard = 0;
+      shard_start = cursor;
+    }
+
+    consumed = saturating_add(consumed, cost);
+    in_shard = saturating_add(in_shard, cost);
+  };
+
+  for (size_t b = 0; b < 256; b++) {
+    instruction_bytes const first_byte { (uint8_t)b };
+
+    if (not refined[b]) {
+      add(first_byte, first_byte_cost[b]);
+      continue;
+    }
+
+    // The first byte on its own goes with its first child.
+    uint64_t carry = 1;
+    estimate_children<MAX_PREFIXES>(features, first_byte, 1, samples,
+                                    [&] (instruction_bytes const &child, uint64_t cost) {
+                                      add(child, saturating_add(carry, cost));
+                                      carry = 0;
+                                    });
+  }
+
+  format(">>> Shard ", shard, "/", shards, ": start=");
+  print_cursor(shard_start);
+  format(" (about ", in_shard, " candidates)\n");
+}
+
+static cpu_features const *sift_features;
+static options sift_options;
+
+// How many CPUs are done searching and how many are done altogether.
+static size_t cpus_sifted;
+static size_t cpus_done;
+
+// The other CPUs wait for this before they start sifting, so the boot CPU can
+// finish printing everything that comes before the results.
+static bool sifting_started;
+
+// How many more execution attempts all CPUs together may retire, if there is a
+// stop_after limit.
+static int64_t attempts_left;
+
+// Whether any CPU stopped before its search was complete.
+static bool stopped_early;
+
+// How many execution attempts each CPU has retired. Only the CPU itself writes
+// its entry.
+static uint64_t attempts_retired[max_cpus];
+
+// Take one execution attempt from the budget all CPUs share. Returns false, if
+// we hit the stop_after limit.
+static bool take_execution_attempt(options const &options)
+{
+  return options.stop_after == 0 or
+    __atomic_sub_fetch(&attempts_left, 1, __ATOMIC_RELAXED) >= 0;
+}
+
+// In differential mode, every CPU sends the interesting instructions it finds
+// to a partner CPU. The partner executes them again and reports disagreements.
+// We prefer partners with a different signature, because that's where
+// disagreements are likely.
+
+struct verification_request {
+  instruction_bytes instr;
+  cpu_verdict found;
+};
+
+static mpsc_ring<verification_request, 64> verification_inbox[max_cpus];
+static cpu_signature cpu_signatures[max_cpus];
+static size_t verification_partner[max_cpus];
+static size_t cpus_registered;
+
+static bool same_kind_of_cpu(cpu_signature const &a, cpu_signature const &b)
+{
+  return a.signature == b.signature and a.core_type == b.core_type;
+}
+
+// Record our signature and pick a partner once everyone has done so.
+static void register_for_verification()
+{
+  size_t const cpu = get_cpu_index();
+  size_t const cpu_count = get_cpu_count();
+
+  cpu_signatures[cpu] = get_cpu_signature();
+  __atomic_add_fetch(&cpus_registered, 1, __ATOMIC_ACQ_REL);
+
+  while (__atomic_load_n(&cpus_registered, __ATOMIC_ACQUIRE) < cpu_count)
+    pause();
+
+  // Without a different kind of CPU, we at least check with our neighbor.
+  size_t partner = (cpu + 1) % cpu_count;
+  for (size_t i = 1; i < cpu_count; i++) {
+    size_t const other = (cpu + i) % cpu_count;
+
+    if (not same_kind_of_cpu(cpu_signatures[cpu], cpu_signatures[other])) {
+      partner = other;
+      break;
+    }
+  }
+
+  verification_partner[cpu] = partner;
+}
+
+static cpu_verdict make_verdict(execution_attempt const &attempt)
+{
+  size_t const cpu = get_cpu_index();
+  cpu_verdict verdict;
+
+  verdict.attempt = attempt;
+  verdict.cpu = (uint16_t)cpu;
+  verdict.signature = cpu_signatures[cpu].signature;
+  verdict.core_type = cpu_signatures[cpu].core_type;
+  return verdict;
+}
+
+// Execute the instructions other CPUs have sent us and report where we
+// disagree. Any difference in length or exception counts, including the ones
+// is_interesting_change() lets slide while sifting.
+static void verify_requests(cpu_features const &features)
+{
+  auto &inbox = verification_inbox[get_cpu_index()];
+  verification_request request;
+
+  while (inbox.pop(request)) {
+    auto const attempt = find_instruction_length(features, request.instr,
+                                                 request.found.attempt.length);
+
+    if (request.found.attempt != attempt)
+      report_disagreement(request.instr, request.found, make_verdict(attempt));
+  }
+}
+
+// Everything a CPU does for others when it's not sifting.
+static void help_out()
+{
+  verify_requests(*sift_features);
+  drain_results();
+}
+
+static void request_verification(instruction_bytes const &instr,
+                                 execution_attempt const &attempt)
+{
+  verification_request const request { instr, make_verdict(attempt) };
+  auto &inbox = verification_inbox[verification_partner[get_cpu_index()]];
+
+  // Our partner might be waiting for us as well, so we have to keep working
+  // on our own inbox.
+  while (not inbox.push(request)) {
+    help_out();
+    pause();
+  }
+}
+
+// Search the given range with the given prefix budget and print all
+// interesting instructions. Whenever another CPU is idle, we split off the
+// upper half of what is left and offer it. Returns false, if we hit the
+// stop_after limit.
+//
+// The first candidate of a range is always printed, because we don't know the
+// attempt of the candidate right before it. So the output of a split search is
+// a superset of the output of a sequential one with a few extra lines.
+//
+// The same holds for the first candidate with a new first byte. This way,
+// searches that start at a first byte print exactly what a search passing
+// through it would, and shards concatenate to a full run. This costs at most
+// one extra line per first byte compared to a search that never forgets the
+// last attempt.
+//
+// Between batches, we print a checkpoint every now and then. A search that
+// resumes from it with the same last attempt prints exactly what we would
+// have printed.
+template <size_t MAX_PREFIXES>
+static bool sift(cpu_features const &features, options &options,
+                 search_engine<MAX_PREFIXES> search, execution_attempt last_attempt)
+{
+  size_t since_checkpoint = 0;
+  uint64_t retired = 0;
+  instruction_bytes batch[speculation_depth];
+  execution_attempt batch_attempts[speculation_depth];
+  bool done = search.is_empty() or
+    (options.has_end and not (search.get_candidate() < options.end));
+  bool stopped = false;
+  uint8_t first_byte = search.get_candidate().raw[0];
+
+  while (not done) {
+    size_t batch_size = 0;
+    search_range upper;
+
+    if (work_wanted() and search.split(upper))
+      offer_work(upper);
+
+    if (options.checkpoint_every != 0 and since_checkpoint >= options.checkpoint_every) {
+      // The next candidate starts from a clean slate anyway, if it has a new
+      // first byte. See above.
+      bool const new_first_byte = search.get_candidate().raw[0] != first_byte;
+
+      search_checkpoint const checkpoint = search.get_checkpoint();
+      execution_attempt const last = new_first_byte ? execution_attempt {} : last_attempt;
+
+      report_checkpoint(checkpoint, last);
+      since_checkpoint = 0;
+
+      // Everything before the checkpoint has to be out, before we can
+      // resume from it. We are the only CPU in this mode, so draining can't
+      // fail. With serial_irq=1, the results may still sit in the serial
+      // queue after that.
+      if (options.nvram) {
+        drain_results();
+        sync_output();
+        save_nvram_checkpoint({ checkpoint, last, false });
+      }
+    }
+
+    if (options.differential)
+      verify_requests(features);
+
+    drain_results_if_needed();
+
+    // Predict the next candidates assuming that none of them results in an
+    // interesting change. Then the search engine only ever clears the bytes
+    // after the current instruction length.
+    auto speculation = search;
+    do {
+      batch[batch_size++] = speculation.get_candidate();
+      speculation.clear_after(last_attempt.length);
+    } while (batch_size < speculation_depth and speculation.find_next_candidate());
+
+    size_t hint = last_attempt.length;
+    for (size_t i = 0; i < batch_size; i++) {
+      batch_attempts[i] = find_instruction_length(features, batch[i], hint);
+      hint = batch_attempts[i].length;
+    }
+
+    // Retire the results in order. The prediction holds until the first
+    // interesting change. Everything after it is discarded.
+    for (size_t i = 0; i < batch_size and not done; i++) {
+      auto const &candidate = search.get_candidate();
+      auto const &attempt = batch_attempts[i];
+
+      if (not take_execution_attempt(options)) {
+        stopped = done = true;
+        break;
+      }
+
+      if (candidate.raw[0] != first_byte) {
+        first_byte = candidate.raw[0];
+        last_attempt = {};
+      }
+
+      bool const interesting = is_interesting_change(last_attempt, attempt);
+
+      search.clear_after(attempt.length);
+
+      if (interesting) {
+        search.start_over(attempt.length);
+
+        // In differential mode, incomplete fetches are interesting as well.
+        if (options.differential)
+          request_verification(candidate, attempt);
+        else if (attempt.length <= sizeof(candidate.raw))
+          report_result(candidate, attempt);
+      }
+
+      last_attempt = attempt;
+      since_checkpoint++;
+      retired++;
+      done = not search.find_next_candidate() or
+        (options.has_end and not (search.get_candidate() < options.end));
+
+      if (interesting)
+        break;
+    }
+  }
+
+  attempts_retired[get_cpu_index()] += retired;
+  return not stopped;
+}
+
+template <size_t MAX_PREFIXES>
+static bool sift(cpu_features const &features, options &options,
+                 search_range const &range, bool resume)
+{
+  if (resume)
+    return sift(features, options, search_engine<MAX_PREFIXES>(options.resume),
+                options.resume_last);
+
+  return sift(features, options, search_engine<MAX_PREFIXES>(range), {});
+}
+
+// The range a CPU starts with. The CPUs divide the first bytes from the start
+// cursor to the end cursor among themselves. sift() stops at the end cursor.
+static search_range initial_range(options const &options, size_t cpu, size_t cpu_count)
+{
+  // When we resume, the boot CPU takes the whole checkpoint and everyone else
+  // has to steal from it.
+  if (options.has_resume)
+    return { {}, 0, 0 };
+
+  size_t const first = options.start.raw[0];
+  size_t end = 256;
+
+  if (options.has_end) {
+    instruction_bytes const end_first_byte { options.end.raw[0] };
+    end = options.end.raw[0] + (end_first_byte < options.end ? 1 : 0);
+  }
+
+  if (end < first)
+    end = first;
+
+  size_t const cpu_first = first + (end - first) * cpu / cpu_count;
+  size_t const cpu_end = first + (end - first) * (cpu + 1) / cpu_count;
+
+  // Whoever starts at the first byte of the start cursor starts at the cursor.
+  if (cpu_first == first)
+    return { options.start, 0, cpu_end };
+
+  return { { (uint8_t)cpu_first }, 0, cpu_end };
+}
+
+// Sift on the current CPU. Each CPU starts with a disjoint range of first bytes
+// and then helps out the others until there is nothing left to do.
+static void sift_on_this_cpu()
+{
+  size_t const cpu = get_cpu_index();
+  size_t const cpu_count = get_cpu_count();
+  search_range range = initial_range(sift_options, cpu, cpu_count);
+
+  auto options = sift_options;
+  auto const &features = *sift_features;
+
+  // The boot CPU has already done this.
+  if (cpu != 0 and user_fpu_enabled)
+    enable_user_fpu();
+
+  if (options.differential)
+    register_for_verification();
+
+  bool resume = options.has_resume and cpu == 0;
+  bool more;
+  do {
+    switch (options.prefixes < max_prefix_groups ? options.prefixes : max_prefix_groups) {
+    case 0: more = sift<0>(features, options, range, resume); break;
+    case 1: more = sift<1>(features, options, range, resume); break;
+    case 2: more = sift<2>(features, options, range, resume); break;
+    case 3: more = sift<3>(features, options, range, resume); break;
+    case 4: more = sift<4>(features, options, range, resume); break;
+    default: more = sift<5>(features, options, range, resume); break;
+    }
+
+    resume = false;
+    if (not more) {
+      __atomic_store_n(&stopped_early, true, __ATOMIC_RELAXED);
+      stop_working();
+    }
+  } while (more and find_work(range, help_out));
+
+  __atomic_add_fetch(&cpus_sifted, 1, __ATOMIC_ACQ_REL);
+
+  // Other CPUs may still send us instructions to verify until they are done
+  // sifting as well.
+  while (__atomic_load_n(&cpus_sifted, __ATOMIC_ACQUIRE) < cpu_count) {
+    help_out();
+    pause();
+  }
+
+  help_out();
+  __atomic_add_fetch(&cpus_done, 1, __ATOMIC_RELEASE);
+}
+
+static void sift_on_application_processor()
+{
+  while (not __atomic_load_n(&sifting_started, __ATOMIC_ACQUIRE))
+    pause();
+
+  sift_on_this_cpu();
+}
+
 void start(cpu_features const &features, char *cmdline)
 {
   print_logo();
 
+  uint16_t const run_id = nvram_run_id(cmdline);
   auto options = parse_and_destroy_cmdline(cmdline);
+
+  // Nothing has been written out yet, so this includes the logo.
+  if (options.serial_port != 0 or options.serial_baud != 115200)
+    configure_serial_output(options.serial_port, options.serial_baud);
+
+  if (options.serial_irq) {
+    if (enable_output_interrupts())
+      format(">>> Writing to the serial port in the background.\n");
+    else
+      format(">>> Only serial output can be interrupt-driven.\n");
+  }
   const auto sig = get_cpu_signature();
   format(">>> CPU is ", sig.vendor, " ", hex(sig.signature, 8, false), ".\n");
 
+  if (options.user_fpu) {
+    if (enable_user_fpu())
+      format(">>> Enabling FPU for user space.\n");
+    else
+      format(">>> CPU can't track FPU state. Keeping FPU disabled.\n");
+  }
+
+  if (options.sysret) {
+    if (enable_sysret_entry())
+      format(">>> Entering user space via SYSRET.\n");
+    else
+      format(">>> SYSRET does not help here. Keeping IRET.\n");
+  }
+
+  if (options.nvram) {
+    nvram_checkpoint saved;
+
+    // Checkpoints of several CPUs don't fit, so this mode is single-CPU.
+    if (options.cpus != 1) {
+      format(">>> Only sifting on one CPU to keep NVRAM checkpoints exact.\n");
+      options.cpus = 1;
+    }
+
+    // Without checkpoints, there is nothing to keep.
+    if (options.checkpoint_every == 0)
+      options.checkpoint_every = 10000000;
+
+    if (load_nvram_checkpoint(run_id, saved)) {
+      if (saved.finished) {
+        format(">>> NVRAM says this sweep is done already.\n");
+        wait_forever();
+      }
+
+      format(">>> Resuming from NVRAM checkpoint.\n");
+      options.has_resume = true;
+      options.resume = saved.checkpoint;
+      options.resume_last = saved.last;
+    }
+  }
+
   format(">>> Executing self test.\n");
   self_test_instruction_length(features);
 
@@ -180,28 +1170,80 @@ void start(cpu_features const &features, char *cmdline)
          " legacy prefix", options.prefixes == 1 ? "" : "es",
          ".\n");
   if (options.stop_after)
-    format(">>> Stopping after ", options.stop_after, " execution attemps.\n");
+    format(">>> Stopping after ", options.stop_after, " execution attemps on all CPUs together.\n");
+  if (options.differential)
+    format(">>> Only reporting instructions on which CPUs disagree.\n");
 
-  search_engine search { options.prefixes };
-  execution_attempt last_attempt;
+  if (options.checkpoint_every)
+    format(">>> Printing a checkpoint every ", options.checkpoint_every,
+           " execution attempts.\n");
 
-  do {
-    auto const &candidate = search.get_candidate();
-    auto attempt = find_instruction_length(features, candidate);
-
-    search.clear_after(attempt.length);
+  format(">>> Searching from ");
+  if (options.has_resume)
+    format("checkpoint at ");
+  print_cursor(options.has_resume ? options.resume.current : options.start);
+  if (options.has_end) {
+    format(" up to ");
+    print_cursor(options.end);
+  }
+  format(".\n");
 
-    if (is_interesting_change(last_attempt, attempt)) {
-      search.start_over(attempt.length);
+  if (options.plan) {
+    format(">>> Planning ", options.plan, " shards with ", options.plan_samples,
+           " samples per subtree.\n");
 
-      if (attempt.length <= sizeof(candidate.raw))
-        print_instruction(candidate, attempt);
+    switch (options.prefixes < max_prefix_groups ? options.prefixes : max_prefix_groups) {
+    case 0: plan_shards<0>(features, options.plan, options.plan_samples); break;
+    case 1: plan_shards<1>(features, options.plan, options.plan_samples); break;
+    case 2: plan_shards<2>(features, options.plan, options.plan_samples); break;
+    case 3: plan_shards<3>(features, options.plan, options.plan_samples); break;
+    case 4: plan_shards<4>(features, options.plan, options.plan_samples); break;
+    default: plan_shards<5>(features, options.plan, options.plan_samples); break;
     }
 
-    last_attempt = attempt;
-  } while (--options.stop_after > 0 && search.find_next_candidate());
+    format(">>> Done!\n");
+    sync_output();
+    outbi<0x64>(0xFE);
+    return;
+  }
+
+  sift_features = &features;
+  sift_options = options;
+  attempts_left = options.stop_after;
+
+  flush_output();
+  start_application_processors(options.cpus, sift_on_application_processor);
+
+  if (options.binary)
+    start_binary_results();
+
+  flush_output();
+  __atomic_store_n(&sifting_started, true, __ATOMIC_RELEASE);
+  sift_on_this_cpu();
+
+  while (__atomic_load_n(&cpus_done, __ATOMIC_ACQUIRE) < get_cpu_count()) {
+    drain_results();
+    pause();
+  }
+
+  drain_results();
+
+  if (options.binary)
+    end_binary_results();
+
+  uint64_t retired = 0;
+  for (size_t cpu = 0; cpu < get_cpu_count(); cpu++)
+    retired += attempts_retired[cpu];
+
+  format(">>> Retired ", retired, " execution attempts.\n");
+
+  // Don't start over after the reset below. A sweep that hit the stop_after
+  // limit is not done, so we keep its last checkpoint.
+  if (options.nvram and not __atomic_load_n(&stopped_early, __ATOMIC_ACQUIRE))
+    save_nvram_checkpoint({ {}, {}, true });
 
   format(">>> Done!\n");
+  sync_output();
 
   // Reset
   outbi<0x64>(0xFE);
@@ -1,5 +1,7 @@
 #include "arch.hpp"
 #include "entry.hpp"
+#include "fpu.hpp"
+#include "pic.hpp"
 #include "selectors.hpp"
 #include "util.hpp"
 #include "x86.hpp"
@@ -18,31 +20,62 @@ alignas(page_size) static uint32_t pdt[page_size / sizeof(uint32_t)];
 // Page table for user code.
 alignas(page_size) static uint32_t user_pt[page_size / sizeof(uint32_t)];
 
-alignas(page_size) static char user_page_backing[page_size];
+alignas(page_size) static char user_page_backing[user_page_count][page_size];
 
 static tss tss;
 
-// The RIP where execution continues after a user space exception.
-static void *ring0_continuation = nullptr;
+// The stack for exceptions from user space with the user exit state on top.
+static struct {
+  uint32_t stack[16];
+  user_exit_state exit_state;
+} ring3_exception_area;
 
-// The place where to store exception frames from user space.
-static exception_frame *ring3_exception_frame = nullptr;
-
-char *get_user_page_backing()
+char *get_user_page_backing(size_t i)
 {
-  return user_page_backing;
+  return user_page_backing[i];
 }
 
-uintptr_t get_user_page()
+uintptr_t get_user_page(size_t)
 {
   // Needs to be in the reach of 16-bit code, so we don't need a different
   // mapping for 16-bit code. Don't use 1MB directly, because this will case the
   // sifting algorithm to find accidentally generate valid memory addresses and
   // needlessly enlarge the search space.
-
+  //
+  // We can't put the user pages far enough apart that a memory operand in one
+  // can't reach another. So there is only one and we switch what it maps.
   return (1UL << 20 /* MiB */) + page_size;
 }
 
+void select_user_page(size_t i)
+{
+  static size_t selected = 0;
+
+  if (i == selected)
+    return;
+
+  uintptr_t const up = get_user_page(i);
+
+  user_pt[bit_select(22, 12, up)] = reinterpret_cast<uintptr_t>(get_user_page_backing(i)) | PTE_U | PTE_P;
+  invlpg(up);
+  selected = i;
+}
+
+size_t get_cpu_count()
+{
+  return 1;
+}
+
+size_t get_cpu_index()
+{
+  return 0;
+}
+
+void start_application_processors(size_t, void (*)())
+{
+  format(">>> Running on 1 CPU.\n");
+}
+
 static bool is_aligned(uint64_t v, int order)
 {
   assert(order < (int)sizeof(v)*8, "Order out of range");
@@ -62,12 +95,12 @@ static void setup_paging()
     pdt[idx] = c | PTE_P | PTE_W | PTE_PS;
   }
 
-  // Map user page
-  uintptr_t up = get_user_page();
+  // Map user page. See select_user_page().
+  uintptr_t up = get_user_page(0);
 
   assert(up + page_size <= istart, "User page cannot be mapped into kernel area");
   pdt[bit_select(32, 22, up)] = reinterpret_cast<uintptr_t>(user_pt) | PTE_U | PTE_P;
-  user_pt[bit_select(22, 12, up)] = reinterpret_cast<uintptr_t>(get_user_page_backing()) | PTE_U | PTE_P;
+  user_pt[bit_select(22, 12, up)] = reinterpret_cast<uintptr_t>(get_user_page_backing(0)) | PTE_U | PTE_P;
 
   set_cr4(get_cr4() | CR4_PSE | CR4_SMEP);
   set_cr3((uintptr_t)pdt);
@@ -88,6 +121,7 @@ static void setup_gdt()
   lgdt(gdt);
 
   tss.ss0 = ring0_data_selector;
+  tss.esp0 = reinterpret_cast<uintptr_t>(&ring3_exception_area.exit_state);
   ltr(ring0_tss_selector);
 
   // Reload code segment descriptor
@@ -116,22 +150,13 @@ static void print_exception(exception_frame const &ef)
   format("!!! ESI ", hex(ef.esi), "\n");
 }
 
+// Exceptions from user space are handled in entry.asm, so we only end up here
+// for kernel exceptions and interrupts. We never take interrupts in user space.
 void irq_entry(exception_frame &ef)
 {
-  // We have to check CS here, because for kernel exceptions SS is not pushed.
-  if ((ef.cs & 3) and ring0_continuation) {
-    auto ret = ring0_continuation;
-    ring0_continuation = nullptr;
-
-    if (ring3_exception_frame) {
-      *ring3_exception_frame = ef;
-      ring3_exception_frame = nullptr;
-    }
-
-    asm ("mov %0, %%esp\n"
-         "jmp *%1\n"
-         :: "r" (tss.esp0), "r" (ret) : "memory");
-    __builtin_unreachable();
+  if (ef.vector >= pic_vector_base) {
+    handle_pic_interrupt(ef.vector);
+    return;
   }
 
   print_exception(ef);
@@ -148,8 +173,9 @@ __attribute__((used)) uint32_t clobbered_edi;
 
 // Execute user code at the specified address. Returns after an exception with
 // the details of the exception.
-exception_frame execute_user(uintptr_t ip)
+user_result execute_user(uintptr_t ip)
 {
+  auto &exit_state = ring3_exception_area.exit_state;
   exception_frame user {};
 
   user.cs = ring3_code_selector;
@@ -157,12 +183,14 @@ exception_frame execute_user(uintptr_t ip)
   user.ss = ring3_data_selector;
   user.eflags = (1 /* TF */ << 8) | 2;
 
-  ring3_exception_frame = &user;
+  // Interrupts would end up as results. We take them in the kernel when we
+  // are back.
+  bool const interrupts = interrupts_enabled();
+  if (interrupts)
+    cli();
 
   // Prepare our stack to call irq_exit and exit to user space. We save a
   // continuation so we return here after an exception.
-  //
-  // TODO If we get a ring0 exception, we have a somewhat clobbered stack pointer.
   asm ("mov %%ebp, clobbered_ebp\n"
        "mov %%edi, clobbered_edi\n"
        "lea 1f, %%eax\n"
@@ -173,7 +201,7 @@ exception_frame execute_user(uintptr_t ip)
        "1:\n"
        "mov clobbered_ebp, %%ebp\n"
        "mov clobbered_edi, %%edi\n"
-       : [ring0_rsp] "=m" (tss.esp0), [cont] "=m" (ring0_continuation),
+       : [ring0_rsp] "=m" (exit_state.ring0_sp), [cont] "=m" (exit_state.ring0_continuation),
          [user] "+m" (user)
        :
        // Everything except EBP/RDI is clobbered, because we come back
@@ -181,7 +209,16 @@ exception_frame execute_user(uintptr_t ip)
        : "eax", "ecx", "edx", "ebx", "esi",
          "memory");
 
-  return user;
+  if (interrupts)
+    sti();
+
+  reset_user_fpu();
+  return exit_state.result;
+}
+
+bool enable_sysret_entry()
+{
+  return false;
 }
 
 static void setup_idt()
@@ -203,6 +240,7 @@ extern "C" cpu_features const *setup_arch()
   setup_paging();
   setup_gdt();
   setup_idt();
+  setup_fpu();
 
   static cpu_features features;
 
@@ -20,10 +20,25 @@ irq_entry_%1:
   jmp near save_context
 %endmacro
 
+  ; Offsets into user_exit_state. See entry.hpp.
+%define EXIT_VECTOR 0
+%define EXIT_ERROR_CODE 4
+%define EXIT_IP 8
+%define EXIT_CR2 12
+%define EXIT_RING0_SP 16
+%define EXIT_CONTINUATION 20
+
+  ; For exceptions from user space, the user exit state is right above the
+  ; hardware exception frame (SS, ESP, EFLAGS, CS, EIP) and the error code and
+  ; vector we pushed.
+%define EXIT_STATE_OFFSET (7 * 4)
+
   ; Save the general-purpose registers and branch to the interrupt entry in C++.
 save_context:
   cld
-  clts                          ; enable FPU
+  test byte [esp + 12], 3       ; interrupted CS
+  jnz ring3_exit
+
   pusha
 
   mov eax, 0x2b                 ; Userspace might have destroyed these
@@ -35,13 +50,34 @@ save_context:
   mov eax, esp                  ; exception_frame
   call irq_entry
 irq_exit:
-  mov eax, cr0
-  or eax, (1 << 3)              ; disable FPU
-  mov cr0, eax
   popa
   add esp, 8                    ; error code / vector
   iret
 
+  ; Exceptions from user space only need to report what happened and resume
+  ; the kernel where it left off in execute_user. The user register state is
+  ; discarded.
+ring3_exit:
+  mov eax, 0x2b                 ; Userspace might have destroyed these
+  mov ds, eax
+  mov es, eax
+  mov fs, eax
+  mov gs, eax
+
+  lea esi, [esp + EXIT_STATE_OFFSET]
+
+  mov eax, [esp]                ; vector
+  mov [esi + EXIT_VECTOR], eax
+  mov eax, [esp + 4]            ; error code
+  mov [esi + EXIT_ERROR_CODE], eax
+  mov eax, [esp + 8]            ; EIP
+  mov [esi + EXIT_IP], eax
+  mov eax, cr2
+  mov [esi + EXIT_CR2], eax
+
+  mov esp, [esi + EXIT_RING0_SP]
+  jmp [esi + EXIT_CONTINUATION]
+
 irq_entry_start:
   gen_entry 0
   gen_entry 1
@@ -76,8 +112,26 @@ irq_entry_start:
   gen_entry 29, 1
   gen_entry 30, 1
   gen_entry 31
+
+  ; Interrupts from the PICs. See pic.hpp.
+  gen_entry 32
+  gen_entry 33
+  gen_entry 34
+  gen_entry 35
+  gen_entry 36
+  gen_entry 37
+  gen_entry 38
+  gen_entry 39
+  gen_entry 40
+  gen_entry 41
+  gen_entry 42
+  gen_entry 43
+  gen_entry 44
+  gen_entry 45
+  gen_entry 46
+  gen_entry 47
 irq_entry_end:
 
-%if (irq_entry_end - irq_entry_start) != (irq_entry_2 - irq_entry_1)*32
+%if (irq_entry_end - irq_entry_start) != (irq_entry_2 - irq_entry_1)*48
 %error "Interrupt entry function size is inconsistent."
 %endif
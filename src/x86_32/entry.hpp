@@ -1,9 +1,12 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdlib>
+
+#include "arch.hpp"
 
 // Total number of interrupt handlers
-constexpr size_t irq_entry_count = 32;
+constexpr size_t irq_entry_count = 48;
 
 // An array of interrupt entry functions
 extern "C" char irq_entry_start[];
@@ -12,3 +15,20 @@ extern "C" char irq_entry_end[];
 // Do not call directly. The function expects the stack pointer to point to an
 // exception frame.
 extern "C" void irq_exit();
+
+// Exceptions from user space don't go through irq_entry. The CPU switches to
+// the stack below this structure and entry.asm stores the result right here
+// before it continues at ring0_continuation with ring0_sp as ESP.
+//
+// Keep this in sync with entry.asm.
+struct alignas(16) user_exit_state {
+  user_result result;
+
+  uintptr_t ring0_sp;
+  void *ring0_continuation;
+};
+
+static_assert(offsetof(user_exit_state, ring0_sp) == 4 * sizeof(uintptr_t),
+              "entry.asm expects a different layout");
+static_assert(offsetof(user_exit_state, ring0_continuation) == 5 * sizeof(uintptr_t),
+              "entry.asm expects a different layout");
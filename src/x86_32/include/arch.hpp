@@ -22,13 +22,50 @@ struct exception_frame {
   uint32_t ss;
 };
 
+// What the kernel learns about executing user code. This is filled in by the
+// assembly entry code.
+struct user_result {
+  uintptr_t vector;
+  uintptr_t error_code;
+  uintptr_t ip;
+  uintptr_t cr2;
+};
+
 const size_t page_size = 4096;
 
-// The user space page as a read-only user-accessible mapping.
-uintptr_t get_user_page();
+// The number of user pages. Only one of them is visible to user space at a
+// time. It is followed by an unmapped guard page, so instructions can be placed
+// right before its end.
+const size_t user_page_count = 15;
+
+// The maximum number of CPUs we sift on. The 32-bit build only uses the boot
+// CPU.
+const size_t max_cpus = 1;
+
+// The given user space page of the current CPU as a read-only user-accessible
+// mapping. Every CPU has its own set of user pages.
+uintptr_t get_user_page(size_t i);
+
+// Make the given user page the one that is visible to user space. All user
+// pages share the same address.
+void select_user_page(size_t i);
 
-// The user space page as a read-write supervisor-accessible mapping.
-char *get_user_page_backing();
+// The given user space page of the current CPU as a read-write
+// supervisor-accessible mapping.
+char *get_user_page_backing(size_t i);
+
+// Return the number of CPUs that run the entry function passed to
+// start_application_processors() including the boot CPU.
+size_t get_cpu_count();
+
+// Return the index of the current CPU. The boot CPU has index zero and the
+// others are numbered consecutively.
+size_t get_cpu_index();
+
+// Start additional CPUs until there are limit CPUs in total (or as many as
+// possible, if limit is zero). Each of them calls entry. Returns once all
+// started CPUs are released into entry.
+void start_application_processors(size_t limit, void (*entry)());
 
 struct cpu_features;
 
@@ -37,4 +74,8 @@ extern "C" void start(cpu_features const &features, char *cmdline);
 
 // Try to execute a single userspace instruction and return the exception that
 // resulted.
-exception_frame execute_user(uintptr_t rip);
+user_result execute_user(uintptr_t rip);
+
+// Enter user space via SYSRET instead of IRET. SYSRET only returns to 64-bit
+// code, so this always returns false in the 32-bit build.
+bool enable_sysret_entry();
@@ -1,55 +1,68 @@
 #include "arch.hpp"
 #include "avx.hpp"
+#include "cpu_local.hpp"
 #include "entry.hpp"
+#include "fpu.hpp"
 #include "paging.hpp"
+#include "pic.hpp"
 #include "selectors.hpp"
 #include "x86.hpp"
 #include "util.hpp"
 #include "cpu_features.hpp"
+#include "msr.hpp"
+#include "smp.hpp"
 
 extern "C" void irq_entry(exception_frame &);
 
-// We only need interrupt descriptors for exceptions.
+// We only need interrupt descriptors for exceptions and PIC interrupts.
 static idt_desc idt[irq_entry_count];
-static tss tss;
-static gdt_desc gdt[6] {
-  {},
-  gdt_desc::kern_code64_desc(),
-  gdt_desc::kern_data64_desc(),
-  gdt_desc::tss_desc(&tss),
-  gdt_desc::user_code64_desc(),
-  gdt_desc::user_data64_desc(),
-};
-
-// The RIP where execution continues after a user space exception.
-static void *ring0_continuation = nullptr;
-
-// The place where to store exception frames from user space.
-static exception_frame *ring3_exception_frame = nullptr;
 
-void setup_idt()
+// How we enter user space. This is either irq_exit or sysret_exit.
+static void (*user_entry)() = irq_exit;
+
+static cpu_local_area &this_cpu()
 {
-  size_t entry_fn_size = (irq_entry_end - irq_entry_start) / irq_entry_count;
+  return get_cpu_local_area(get_cpu_index());
+}
 
-  for (size_t i = 0; i < array_size(idt); i++) {
-    idt[i] = idt_desc::interrupt_gate(ring0_code_selector,
-				      reinterpret_cast<uint64_t>(irq_entry_start + i*entry_fn_size),
-				      0, 0);
-  }
+// Load the GDT, TSS and IDT of the current CPU.
+static void load_descriptor_tables()
+{
+  cpu_local_area &cpu = this_cpu();
+
+  cpu.gdt[0] = {};
+  cpu.gdt[1] = gdt_desc::kern_code64_desc();
+  cpu.gdt[2] = gdt_desc::kern_data64_desc();
+  cpu.gdt[3] = gdt_desc::tss_desc(&cpu.tss);
+  cpu.gdt[4] = gdt_desc::user_data_code64_desc();
 
   // Load a new GDT that also includes a task gate.
-  lgdt(gdt);
+  lgdt(cpu.gdt);
 
   // Our selectors are already correct, because we use the same ones as in the
   // boot GDT.
 
   // Point the task register to the newly created task gate, so the CPU knows
   // where to find stacks for exception/interrupt handling.
+  cpu.tss.rsp[0] = reinterpret_cast<uintptr_t>(&cpu.ring3_exception_area.exit_state);
   ltr(ring0_tss_selector);
 
   lidt(idt);
 }
 
+void setup_idt()
+{
+  size_t entry_fn_size = (irq_entry_end - irq_entry_start) / irq_entry_count;
+
+  for (size_t i = 0; i < array_size(idt); i++) {
+    idt[i] = idt_desc::interrupt_gate(ring0_code_selector,
+				      reinterpret_cast<uint64_t>(irq_entry_start + i*entry_fn_size),
+				      0, 0);
+  }
+
+  load_descriptor_tables();
+}
+
 static void print_exception(exception_frame const &ef)
 {
   format("!!! exception ", ef.vector, " (", hex(ef.error_code), ") at ",
@@ -59,21 +72,13 @@ static void print_exception(exception_frame const &ef)
   format("!!! RSI ", hex(ef.rsi), "\n");
 }
 
+// Exceptions from user space are handled in entry.asm, so we only end up here
+// for kernel exceptions and interrupts. We never take interrupts in user space.
 void irq_entry(exception_frame &ef)
 {
-  if ((ef.ss & 3) and ring0_continuation) {
-    auto ret = ring0_continuation;
-    ring0_continuation = nullptr;
-
-    if (ring3_exception_frame) {
-      *ring3_exception_frame = ef;
-      ring3_exception_frame = nullptr;
-    }
-
-    asm ("mov %0, %%rsp\n"
-	 "jmp *%1\n"
-	 :: "r" (tss.rsp[0]), "r" (ret) : "memory");
-    __builtin_unreachable();
+  if (ef.vector >= pic_vector_base) {
+    handle_pic_interrupt(ef.vector);
+    return;
   }
 
   print_exception(ef);
@@ -81,11 +86,38 @@ void irq_entry(exception_frame &ef)
   wait_forever();
 }
 
+static bool is_legacy_or_rex_prefix(uint8_t byte)
+{
+  switch (byte) {
+  case 0xF0: case 0xF2: case 0xF3:
+  case 0x2E: case 0x36: case 0x3E: case 0x26: case 0x64: case 0x65:
+  case 0x66: case 0x67:
+  case 0x40 ... 0x4F:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Check whether the user instruction at ip is SYSRET. This is only safe to
+// call for an instruction that was fetched completely.
+static bool is_sysret(uintptr_t ip)
+{
+  auto const *bytes = reinterpret_cast<uint8_t const *>(ip);
+  size_t i = 0;
+
+  // An instruction is at most 15 bytes long, so we never look beyond it.
+  while (i < 13 and is_legacy_or_rex_prefix(bytes[i]))
+    i++;
+
+  return bytes[i] == 0x0F and bytes[i + 1] == 0x07;
+}
+
 // Execute user code at the specified address. Returns after an exception with
 // the details of the exception.
-exception_frame execute_user(uintptr_t rip)
+user_result execute_user(uintptr_t rip)
 {
-  static uint64_t clobbered_rbp;
+  auto &exit_state = this_cpu().ring3_exception_area.exit_state;
   exception_frame user {};
 
   user.cs = ring3_code_selector;
@@ -93,37 +125,128 @@ exception_frame execute_user(uintptr_t rip)
   user.ss = ring3_data_selector;
   user.rflags = (1 /* TF */ << 8) | 2;
 
-  ring3_exception_frame = &user;
+  exit_state.entry_ip = rip;
+
+  // Interrupts would end up as results and SYSRET must not be interrupted. We
+  // take them in the kernel when we are back.
+  bool const interrupts = interrupts_enabled();
+  if (interrupts)
+    cli();
 
   // Prepare our stack to call irq_exit and exit to user space. We save a
-  // continuation so we return here after an exception.
-  //
-  // TODO If we get a ring0 exception, we have a somewhat clobbered stack pointer.
-  asm ("mov %%rbp, %[rbp_save]\n"
-       "lea 1f, %%eax\n"
-       "mov %%eax, %[cont]\n"
-       "mov %%rsp, %[ring0_rsp]\n"
-       "lea %[user], %%rsp\n"
-       "jmp irq_exit\n"
+  // continuation so we return here after an exception. RBP is saved on our
+  // stack, because other CPUs do the same concurrently.
+  auto *state = &exit_state;
+  asm ("lea 1f(%%rip), %%rax\n"
+       "mov %%rax, %c[cont](%[state])\n"
+       "lea %[user], %%rcx\n"
+       "push %%rbp\n"
+       "mov %%rsp, %c[ring0_rsp](%[state])\n"
+       "mov %%rcx, %%rsp\n"
+       "jmp *%[entry]\n"
        "1:\n"
-       "mov %[rbp_save], %%rbp\n"
-       : [ring0_rsp] "=m" (tss.rsp[0]), [cont] "=m" (ring0_continuation),
-	 [user] "+m" (user), [rbp_save] "=m" (clobbered_rbp)
-       :
+       "pop %%rbp\n"
+       : [state] "+D" (state), [user] "+m" (user)
+       : [entry] "m" (user_entry),
+	 [cont] "i" (offsetof(user_exit_state, ring0_continuation)),
+	 [ring0_rsp] "i" (offsetof(user_exit_state, ring0_sp))
        // Everything except RBP is clobbered, because we come back via irq_entry
-       // after basically executing random bytes.
-       : "rax", "rcx", "rdx", "rbx", "rsi", "rdi",
+       // after basically executing random bytes. RDI is clobbered as well.
+       : "rax", "rcx", "rdx", "rbx", "rsi",
 	 "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
 	 "memory");
 
-  return user;
+  if (interrupts)
+    sti();
+
+  reset_user_fpu();
+
+  // SYSRET needs SYSCALL enabled and then SYSRET from user space raises #GP
+  // instead of #UD. We report what it does with SYSCALL disabled.
+  if (user_entry == sysret_exit and exit_state.result.vector == 13 and
+      exit_state.result.error_code == 0 and is_sysret(exit_state.result.ip))
+    exit_state.result.vector = 6;
+
+  return exit_state.result;
+}
+
+static void enable_syscall(bool enable)
+{
+  if (enable) {
+    wrmsr(IA32_STAR, (uint64_t)sysret_selector_base << 48 | (uint64_t)ring0_code_selector << 32);
+    wrmsr(IA32_LSTAR, reinterpret_cast<uintptr_t>(syscall_entry));
+    wrmsr(IA32_FMASK, (1 << 8 /* TF */) | (1 << 9 /* IF */) | (1 << 10 /* DF */) | (1 << 18 /* AC */));
+    wrmsr(IA32_KERNEL_GS_BASE, reinterpret_cast<uintptr_t>(&this_cpu().ring3_exception_area.exit_state));
+    wrmsr(IA32_EFER, rdmsr(IA32_EFER) | IA32_EFER_SCE);
+  } else {
+    wrmsr(IA32_EFER, rdmsr(IA32_EFER) & ~IA32_EFER_SCE);
+  }
+}
+
+// Return the number of cycles it takes to single-step a NOP at the given
+// address. Returns ~0 if single-stepping doesn't work.
+static uint64_t measure_user_entry(void (*entry)(), uintptr_t nop_ip)
+{
+  const size_t rounds = 1000;
+
+  user_entry = entry;
+
+  // SYSRET cannot restore TF on all CPUs without trapping right away.
+  auto const res = execute_user(nop_ip);
+  if (res.vector != 1 or res.ip != nop_ip + 1)
+    return ~0ULL;
+
+  uint64_t const start = rdtsc();
+  for (size_t i = 0; i < rounds; i++)
+    execute_user(nop_ip);
+
+  return (rdtsc() - start) / rounds;
+}
+
+bool enable_sysret_entry()
+{
+  char &nop_byte = get_user_page_backing(0)[page_size - 1];
+  uintptr_t const nop_ip = get_user_page(0) + page_size - 1;
+
+  nop_byte = 0x90;
+
+  enable_syscall(true);
+  uint64_t const sysret_cycles = measure_user_entry(sysret_exit, nop_ip);
+  uint64_t const iret_cycles = measure_user_entry(irq_exit, nop_ip);
+
+  if (sysret_cycles < iret_cycles) {
+    user_entry = sysret_exit;
+  } else {
+    user_entry = irq_exit;
+    enable_syscall(false);
+  }
+
+  // The user pages have to be empty when we return.
+  nop_byte = 0;
+
+  return user_entry == sysret_exit;
+}
+
+void setup_application_processor()
+{
+  load_cpu_page_tables();
+  load_descriptor_tables();
+  try_setup_avx();
+  setup_fpu();
+  enable_syscall(user_entry == sysret_exit);
 }
 
 extern "C" cpu_features const *setup_arch()
 {
-  setup_idt();
+  // Paging comes first, because the descriptor tables live in memory that
+  // setup_paging() allocates.
   setup_paging();
-  try_setup_avx();
+  setup_idt();
+
+  if (try_setup_avx())
+    format(">>> Enabling AVX.\n");
+
+  setup_fpu();
 
   static cpu_features features;
 
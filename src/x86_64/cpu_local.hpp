@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "arch.hpp"
+#include "entry.hpp"
+#include "numa.hpp"
+#include "x86.hpp"
+
+// Everything a CPU touches when it executes user code. Each CPU has its own
+// area in a large page on its NUMA node. See setup_cpu_local_area().
+struct cpu_local_area {
+  alignas(page_size) char user_page_backing[user_page_count][page_size];
+
+  // The paging structures this CPU runs on. They share the kernel mappings
+  // with the boot page tables, but only map the user pages of this CPU.
+  alignas(page_size) uint64_t pml4[512];
+  alignas(page_size) uint64_t pdpt[512];
+  alignas(page_size) uint64_t user_pd[user_page_count][512];
+  alignas(page_size) uint64_t user_pt[user_page_count][512];
+
+  // Application processors run on this stack. The boot CPU keeps the one from
+  // start.asm.
+  alignas(page_size) char stack[4 * page_size];
+
+  gdt_desc gdt[5];
+  struct tss tss;
+
+  // The stack for exceptions from user space with the user exit state on top.
+  struct {
+    uint64_t stack[16];
+    user_exit_state exit_state;
+  } ring3_exception_area;
+};
+
+static_assert(sizeof(cpu_local_area) <= large_page_size, "CPU local area doesn't fit into a large page");
+
+// The local areas are mapped one after the other from here.
+const uintptr_t cpu_local_window = 1UL << 39;
+
+// Allocate the local area of the given CPU on the NUMA node of the given APIC
+// ID and set up its page tables. The area starts out zeroed.
+cpu_local_area &setup_cpu_local_area(size_t cpu, uint32_t apic_id);
+
+// Switch the current CPU to the page tables in its local area.
+void load_cpu_page_tables();
+
+inline cpu_local_area &get_cpu_local_area(size_t cpu)
+{
+  return *reinterpret_cast<cpu_local_area *>(cpu_local_window + cpu * large_page_size);
+}
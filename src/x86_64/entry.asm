@@ -3,7 +3,7 @@
 bits 64
 section .text
 extern irq_entry
-global irq_entry_start, irq_entry_end, irq_exit
+global irq_entry_start, irq_entry_end, irq_exit, sysret_exit, syscall_entry
 
   ; Generate an interrupt entry function that takes care of normalizing the
   ; stack frame, i.e. pushes a dummy error code if the processor did not.
@@ -20,10 +20,34 @@ irq_entry_%1:
   jmp near save_context
 %endmacro
 
+  ; Offsets into user_exit_state. See entry.hpp.
+%define EXIT_VECTOR 0
+%define EXIT_ERROR_CODE 8
+%define EXIT_IP 16
+%define EXIT_CR2 24
+%define EXIT_RING0_SP 32
+%define EXIT_CONTINUATION 40
+%define EXIT_ENTRY_IP 48
+
+  ; Offsets into exception_frame. See arch.hpp.
+%define FRAME_IP (17 * 8)
+%define FRAME_RFLAGS (19 * 8)
+%define FRAME_RSP (20 * 8)
+
+%define RING0_DATA_SELECTOR 0x20
+%define EXC_UD 6
+
+  ; For exceptions from user space, the user exit state is right above the
+  ; hardware exception frame (SS, RSP, RFLAGS, CS, RIP) and the error code and
+  ; vector we pushed.
+%define EXIT_STATE_OFFSET (7 * 8)
+
   ; Save the general-purpose registers and branch to the interrupt entry in C++.
 save_context:
   cld
-  clts                          ; enable FPU
+  test byte [rsp + 24], 3       ; interrupted CS
+  jnz ring3_exit
+
   push rax
   push rcx
   push rdx
@@ -44,9 +68,6 @@ save_context:
   lea rdi, [rsp]                ; exception_frame
   call irq_entry
 irq_exit:
-  mov rax, cr0
-  or rax, (1 << 3)            ; disable FPU
-  mov cr0, rax
   pop r15
   pop r14
   pop r13
@@ -66,6 +87,69 @@ irq_exit:
   add rsp, 16                   ; error code / vector
   iretq
 
+  ; Exceptions from user space only need to report what happened and resume
+  ; the kernel where it left off in execute_user. The user register state is
+  ; discarded.
+ring3_exit:
+  lea rsi, [rsp + EXIT_STATE_OFFSET]
+
+  mov rax, [rsp]                ; vector
+  mov [rsi + EXIT_VECTOR], rax
+  mov rax, [rsp + 8]            ; error code
+  mov [rsi + EXIT_ERROR_CODE], rax
+  mov rax, [rsp + 16]           ; RIP
+  mov [rsi + EXIT_IP], rax
+  mov rax, cr2
+  mov [rsi + EXIT_CR2], rax
+
+  mov rsp, [rsi + EXIT_RING0_SP]
+  jmp [rsi + EXIT_CONTINUATION]
+
+  ; Enter user space via SYSRET. This expects the same exception frame as
+  ; irq_exit, but the general-purpose registers are cleared instead of loaded.
+sysret_exit:
+  mov rcx, [rsp + FRAME_IP]
+  mov r11, [rsp + FRAME_RFLAGS]
+
+  xor eax, eax
+  xor edx, edx
+  xor ebx, ebx
+  xor ebp, ebp
+  xor esi, esi
+  xor edi, edi
+  xor r8d, r8d
+  xor r9d, r9d
+  xor r10d, r10d
+  xor r12d, r12d
+  xor r13d, r13d
+  xor r14d, r14d
+  xor r15d, r15d
+
+  ; We run with interrupts disabled. Only an NMI could observe the user stack
+  ; pointer in kernel mode here, and we don't survive kernel NMIs anyway.
+  mov rsp, [rsp + FRAME_RSP]
+  o64 sysret
+
+  ; SYSCALL only needs to be enabled, because SYSRET depends on it. Report it
+  ; as #UD, which is what user space sees when it's disabled. SYSCALL doesn't
+  ; switch stacks, so we find the user exit state via the kernel GS base
+  ; instead. FMASK has cleared TF and DF for us.
+syscall_entry:
+  swapgs
+  mov qword [gs:EXIT_VECTOR], EXC_UD
+  mov qword [gs:EXIT_ERROR_CODE], 0
+  mov rax, [gs:EXIT_ENTRY_IP]
+  mov [gs:EXIT_IP], rax
+
+  ; SYSCALL loads a flat SS selector that doesn't match our GDT.
+  mov eax, RING0_DATA_SELECTOR
+  mov ss, eax
+
+  mov rsp, [gs:EXIT_RING0_SP]
+  mov rax, [gs:EXIT_CONTINUATION]
+  swapgs
+  jmp rax
+
 irq_entry_start:
   gen_entry 0
   gen_entry 1
@@ -100,8 +184,26 @@ irq_entry_start:
   gen_entry 29, 1
   gen_entry 30, 1
   gen_entry 31
+
+  ; Interrupts from the PICs. See pic.hpp.
+  gen_entry 32
+  gen_entry 33
+  gen_entry 34
+  gen_entry 35
+  gen_entry 36
+  gen_entry 37
+  gen_entry 38
+  gen_entry 39
+  gen_entry 40
+  gen_entry 41
+  gen_entry 42
+  gen_entry 43
+  gen_entry 44
+  gen_entry 45
+  gen_entry 46
+  gen_entry 47
 irq_entry_end:
 
-%if (irq_entry_end - irq_entry_start) != (irq_entry_2 - irq_entry_1)*32
+%if (irq_entry_end - irq_entry_start) != (irq_entry_2 - irq_entry_1)*48
 %error "Interrupt entry function size is inconsistent."
 %endif
@@ -30,13 +30,49 @@ struct exception_frame {
   uint64_t ss;
 };
 
+// What the kernel learns about executing user code. This is filled in by the
+// assembly entry code.
+struct user_result {
+  uintptr_t vector;
+  uintptr_t error_code;
+  uintptr_t ip;
+  uintptr_t cr2;
+};
+
 const size_t page_size = 4096;
 
-// The user space page as a read-only user-accessible mapping.
-uintptr_t get_user_page();
+// The number of user pages. Each one is followed by unmapped memory, so
+// instructions can be placed right before the end of any of them. They are 4 GB
+// apart, so a RIP-relative memory operand in one can't reach another.
+const size_t user_page_count = 15;
+
+// The maximum number of CPUs we sift on.
+const size_t max_cpus = 64;
+
+// The given user space page of the current CPU as a read-only user-accessible
+// mapping. Every CPU has its own set of user pages.
+uintptr_t get_user_page(size_t i);
+
+// Make the given user page accessible from user space. All user pages are
+// always mapped here.
+inline void select_user_page(size_t) {}
 
-// The user space page as a read-write supervisor-accessible mapping.
-char *get_user_page_backing();
+// The given user space page of the current CPU as a read-write
+// supervisor-accessible mapping.
+char *get_user_page_backing(size_t i);
+
+// Return the number of CPUs that run the entry function passed to
+// start_application_processors() including the boot CPU.
+size_t get_cpu_count();
+
+// Return the index of the current CPU. The boot CPU has index zero and the
+// others are numbered consecutively.
+size_t get_cpu_index();
+
+// Start additional CPUs until there are limit CPUs in total (or as many as
+// possible, if limit is zero). Each of them calls entry. Returns once all
+// started CPUs are released into entry.
+void start_application_processors(size_t limit, void (*entry)());
 
 struct cpu_features;
 
@@ -45,4 +81,13 @@ extern "C" void start(cpu_features const &features, char *cmdline);
 
 // Try to execute a single userspace instruction and return the exception that
 // resulted.
-exception_frame execute_user(uintptr_t rip);
+user_result execute_user(uintptr_t rip);
+
+// Enter user space via SYSRET instead of IRET, if that works and is faster on
+// this CPU. Returns false, if we keep using IRET. This must be called before
+// start_application_processors().
+//
+// SYSRET leaves RIP in RCX and RFLAGS in R11, where user code sees them, so
+// results may differ from the ones with IRET. With IRET, all general-purpose
+// registers are zero.
+bool enable_sysret_entry();
@@ -0,0 +1,204 @@
+#include <cstring>
+
+#include "acpi.hpp"
+#include "arch.hpp"
+#include "numa.hpp"
+#include "smp.hpp"
+#include "util.hpp"
+
+extern "C" uint32_t multiboot_info;
+extern "C" char _image_end[];
+
+namespace {
+
+enum : uint32_t {
+  MULTIBOOT_INFO_CMDLINE = 1 << 2,
+  MULTIBOOT_INFO_MODS = 1 << 3,
+  MULTIBOOT_INFO_MMAP = 1 << 6,
+
+  // The multiboot information structure including the framebuffer fields.
+  MULTIBOOT_INFO_SIZE = 116,
+};
+
+struct multiboot_module {
+  uint32_t start;
+  uint32_t end;
+  uint32_t string;
+  uint32_t reserved;
+};
+
+struct multiboot_mmap_entry {
+  // The size of the entry without this field.
+  uint32_t size;
+  uint64_t base;
+  uint64_t length;
+  uint32_t type;
+} __attribute__((packed));
+
+enum : uint32_t {
+  MULTIBOOT_MEMORY_AVAILABLE = 1,
+};
+
+// Memory that is not ours to hand out, even if the memory map says it's
+// available.
+struct reserved_range {
+  uint64_t base;
+  uint64_t end;
+};
+
+// Free memory that is aligned to large pages.
+struct free_range {
+  uint64_t base;
+  uint64_t end;
+  uint32_t node;
+};
+
+}
+
+static free_range free_ranges[64];
+static size_t free_range_count;
+
+static reserved_range reserved_ranges[64];
+static size_t reserved_range_count;
+
+static void reserve(uint64_t base, uint64_t length)
+{
+  assert(reserved_range_count < array_size(reserved_ranges), "Too many reserved ranges");
+  reserved_ranges[reserved_range_count++] = { base, base + length };
+}
+
+// Reserve our image, the AP trampoline and everything the boot loader passed
+// us.
+static void reserve_boot_memory(uint32_t const *mbi)
+{
+  // Everything below the end of our image is either BIOS data or ourselves.
+  reserve(0, reinterpret_cast<uintptr_t>(_image_end));
+  reserve(ap_trampoline_base, page_size);
+
+  reserve(reinterpret_cast<uintptr_t>(mbi), MULTIBOOT_INFO_SIZE);
+  reserve(mbi[12], mbi[11]);
+
+  if (mbi[0] & MULTIBOOT_INFO_CMDLINE)
+    reserve(mbi[4], strlen(reinterpret_cast<char const *>(static_cast<uintptr_t>(mbi[4]))) + 1);
+
+  if (mbi[0] & MULTIBOOT_INFO_MODS) {
+    auto const mods = reinterpret_cast<multiboot_module const *>(static_cast<uintptr_t>(mbi[6]));
+
+    reserve(mbi[6], mbi[5] * sizeof(multiboot_module));
+
+    for (size_t i = 0; i < mbi[5]; i++) {
+      reserve(mods[i].start, mods[i].end - mods[i].start);
+
+      if (mods[i].string != 0)
+        reserve(mods[i].string,
+                strlen(reinterpret_cast<char const *>(static_cast<uintptr_t>(mods[i].string))) + 1);
+    }
+  }
+}
+
+static void add_free_range(uint64_t base, uint64_t end, uint32_t node)
+{
+  base = (base + large_page_size - 1) & ~(large_page_size - 1);
+  end &= ~(large_page_size - 1);
+
+  if (base < end and free_range_count < array_size(free_ranges))
+    free_ranges[free_range_count++] = { base, end, node };
+}
+
+// Add the given available memory split up by the NUMA nodes in the SRAT. We
+// leave out the reserved ranges.
+static void add_available_memory(uint64_t base, uint64_t end,
+                                 numa_memory_range const *nodes, size_t node_count)
+{
+  for (size_t i = 0; i < reserved_range_count; i++) {
+    auto const &reserved = reserved_ranges[i];
+
+    if (reserved.base < end and base < reserved.end) {
+      if (base < reserved.base)
+        add_available_memory(base, reserved.base, nodes, node_count);
+      if (reserved.end < end)
+        add_available_memory(reserved.end, end, nodes, node_count);
+      return;
+    }
+  }
+
+  if (node_count == 0) {
+    add_free_range(base, end, 0);
+    return;
+  }
+
+  for (size_t i = 0; i < node_count; i++) {
+    uint64_t const node_base = nodes[i].base;
+    uint64_t const node_end = nodes[i].base + nodes[i].length;
+
+    add_free_range(base > node_base ? base : node_base,
+                   end < node_end ? end : node_end,
+                   nodes[i].node);
+  }
+}
+
+void setup_numa()
+{
+  auto const mbi = reinterpret_cast<uint32_t const *>(static_cast<uintptr_t>(multiboot_info));
+  assert(mbi[0] & MULTIBOOT_INFO_MMAP, "Boot loader didn't pass a memory map");
+
+  numa_memory_range nodes[64];
+  size_t const node_count = get_srat_memory_ranges(nodes, array_size(nodes));
+
+  reserve_boot_memory(mbi);
+
+  uint32_t const mmap_length = mbi[11];
+  uintptr_t const mmap_start = mbi[12];
+
+  for (uintptr_t p = mmap_start; p < mmap_start + mmap_length;) {
+    auto const entry = reinterpret_cast<multiboot_mmap_entry const *>(p);
+
+    if (entry->type == MULTIBOOT_MEMORY_AVAILABLE)
+      add_available_memory(entry->base, entry->base + entry->length, nodes, node_count);
+
+    p += entry->size + sizeof(entry->size);
+  }
+
+  uint64_t free_memory = 0;
+  size_t distinct_nodes = 0;
+
+  for (size_t i = 0; i < free_range_count; i++) {
+    free_memory += free_ranges[i].end - free_ranges[i].base;
+
+    size_t first = 0;
+    while (free_ranges[first].node != free_ranges[i].node)
+      first++;
+
+    if (first == i)
+      distinct_nodes++;
+  }
+
+  format(">>> Found ", free_memory >> 20, " MiB of usable memory on ",
+         distinct_nodes, " NUMA node", distinct_nodes == 1 ? "" : "s", ".\n");
+}
+
+uint64_t alloc_node_large_page(uint32_t node)
+{
+  free_range *fallback = nullptr;
+
+  for (size_t i = 0; i < free_range_count; i++) {
+    free_range &range = free_ranges[i];
+
+    if (range.base == range.end)
+      continue;
+
+    if (range.node == node) {
+      fallback = &range;
+      break;
+    }
+
+    if (not fallback)
+      fallback = &range;
+  }
+
+  assert(fallback, "Out of memory");
+
+  uint64_t const page = fallback->base;
+  fallback->base += large_page_size;
+  return page;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+
+// Memory is handed out in large pages, so it's trivial to map.
+const uint64_t large_page_size = 1UL << 21;
+
+// Find usable physical memory and which NUMA node it belongs to.
+void setup_numa();
+
+// Return the physical address of a free large page on the given NUMA node. If
+// the node has no memory left, the page comes from any other node.
+uint64_t alloc_node_large_page(uint32_t node);
@@ -1,13 +1,26 @@
+#include <cstring>
+
+#include "acpi.hpp"
+#include "apic.hpp"
 #include "arch.hpp"
+#include "cpu_local.hpp"
+#include "numa.hpp"
 #include "paging.hpp"
 #include "util.hpp"
 #include "x86.hpp"
 
-extern char _image_end[];
+// Where the user pages start. Every CPU has its own page tables and sees its
+// own user pages here and nothing else. So results don't depend on the CPU or
+// on what other CPUs are doing.
+static const uintptr_t user_space_base = 1UL << 32;
+
+// The distance between user pages. A disp32 operand only reaches 2 GB in
+// either direction, so an instruction in one user page can't access another.
+static const uintptr_t user_page_stride = 1UL << 32;
 
-uintptr_t get_user_page()
+uintptr_t get_user_page(size_t i)
 {
-  return (1UL << 32);
+  return user_space_base + i * user_page_stride;
 }
 
 // These are our boot page table structures, which are partly setup by the
@@ -20,27 +33,96 @@ alignas(page_size) uint64_t boot_pml4[512];
 alignas(page_size) uint64_t boot_pdpt[512]; // Covers 0 - 512GB
 alignas(page_size) uint64_t boot_pd[512];   // Covers 0 - 1GB
 
-alignas(page_size) static uint64_t user_pd[512]; // Covers 4GB-5GB
-alignas(page_size) static uint64_t user_pt[512]; // Covers 4GB to 4GB+4K
+alignas(page_size) static uint64_t high_pd[3][512]; // Covers 1GB - 4GB
 
-alignas(page_size) static char user_page_backing[page_size];
+alignas(page_size) static uint64_t cpu_local_pdpt[512];
+alignas(page_size) static uint64_t cpu_local_pd[512]; // One large page per CPU
 
-char *get_user_page_backing()
+char *get_user_page_backing(size_t i)
 {
-  return user_page_backing;
+  return get_cpu_local_area(get_cpu_index()).user_page_backing[i];
+}
+
+// The boot code identity maps the first GB. Map the rest of the 32-bit physical
+// address space as well, because we need to access ACPI tables and the local
+// APIC.
+static void setup_identity_map()
+{
+  uint64_t const lapic_page = get_lapic_base() & ~(large_page_size - 1);
+
+  for (size_t i = 0; i < array_size(high_pd); i++) {
+    for (size_t j = 0; j < array_size(high_pd[i]); j++) {
+      uint64_t const phys = ((i + 1) << 30) + j * large_page_size;
+      uint64_t const caching = phys == lapic_page ? PTE_PCD | PTE_PWT : 0;
+
+      high_pd[i][j] = phys | caching | PTE_P | PTE_W | PTE_PS;
+    }
+
+    boot_pdpt[i + 1] = (uintptr_t)high_pd[i] | PTE_P | PTE_W;
+  }
+}
+
+cpu_local_area &setup_cpu_local_area(size_t cpu, uint32_t apic_id)
+{
+  assert(cpu < max_cpus, "CPU index out of range");
+
+  uint64_t const phys = alloc_node_large_page(get_srat_apic_node(apic_id));
+  cpu_local_pd[cpu] = phys | PTE_P | PTE_W | PTE_PS;
+
+  // The entry was not present before, so there is nothing to invalidate.
+  auto &area = get_cpu_local_area(cpu);
+  memset(&area, 0, sizeof(area));
+
+  // The kernel part is the same for everyone. We only need our own copies of
+  // the structures that lead to the user pages.
+  memcpy(area.pml4, boot_pml4, sizeof(area.pml4));
+  memcpy(area.pdpt, boot_pdpt, sizeof(area.pdpt));
+
+  area.pml4[bit_select(48, 39, user_space_base)] = (phys + offsetof(cpu_local_area, pdpt)) | PTE_P | PTE_W | PTE_U;
+
+  // Each user page is in its own GB with its own page directory and page
+  // table.
+  for (size_t i = 0; i < user_page_count; i++) {
+    uintptr_t const page = get_user_page(i);
+    uint64_t const pd = phys + offsetof(cpu_local_area, user_pd) + i * page_size;
+    uint64_t const pt = phys + offsetof(cpu_local_area, user_pt) + i * page_size;
+    uint64_t const backing = phys + offsetof(cpu_local_area, user_page_backing) + i * page_size;
+
+    area.pdpt[bit_select(39, 30, page)] = pd | PTE_P | PTE_U;
+    area.user_pd[i][bit_select(30, 21, page)] = pt | PTE_P | PTE_U;
+    area.user_pt[i][bit_select(21, 12, page)] = backing | PTE_P | PTE_U;
+  }
+
+  // Make sure the compiler actually writes the page table entries.
+  asm volatile ("" ::: "memory");
+  return area;
+}
+
+void load_cpu_page_tables()
+{
+  uint64_t const phys = cpu_local_pd[get_cpu_index()] & ~(large_page_size - 1);
+
+  set_cr3(phys + offsetof(cpu_local_area, pml4));
 }
 
 void setup_paging()
 {
-  const uintptr_t up = get_user_page();
+  const uintptr_t up = user_space_base;
 
   assert((boot_pml4[bit_select(48, 39, up)] & ~0xFFF) == (uintptr_t)boot_pdpt, "PML4 is broken");
 
-  boot_pdpt[bit_select(39, 30, up)] = (uintptr_t)user_pd | PTE_P | PTE_U;
-  user_pd[bit_select(30, 21, up)] = (uintptr_t)user_pt | PTE_P | PTE_U;
-  user_pt[bit_select(21, 12, up)] = (uintptr_t)get_user_page_backing() | PTE_P | PTE_U;
+  setup_identity_map();
+  setup_numa();
 
-  // No TLB invalidation necessary, because we only created new entries. But we
-  // need to make sure the compiler actually writes the values.
-  asm volatile ("" ::: "memory");
+  static_assert(bit_select(48, 39, cpu_local_window) != bit_select(48, 39, up), "CPU local areas overlap user space");
+  static_assert(max_cpus <= array_size(cpu_local_pd), "Too many CPUs for the local area page directory");
+
+  boot_pml4[bit_select(48, 39, cpu_local_window)] = (uintptr_t)cpu_local_pdpt | PTE_P | PTE_W;
+  cpu_local_pdpt[bit_select(39, 30, cpu_local_window)] = (uintptr_t)cpu_local_pd | PTE_P | PTE_W;
+
+  static_assert(bit_select(48, 39, user_space_base + (user_page_count - 1) * user_page_stride) ==
+                bit_select(48, 39, user_space_base), "User pages don't fit into one page directory pointer table");
+
+  setup_cpu_local_area(0, get_lapic_id());
+  load_cpu_page_tables();
 }
@@ -5,5 +5,10 @@
 constexpr uint16_t ring0_code_selector = 0x10;
 constexpr uint16_t ring0_data_selector = 0x20;
 constexpr uint16_t ring0_tss_selector = 0x30;
-constexpr uint16_t ring3_code_selector = 0x43;
-constexpr uint16_t ring3_data_selector = 0x53;
+constexpr uint16_t ring3_data_selector = 0x43;
+constexpr uint16_t ring3_code_selector = 0x4b;
+
+// SYSRET derives both user selectors from this.
+constexpr uint16_t sysret_selector_base = ring3_data_selector - 8;
+
+static_assert(ring3_code_selector == sysret_selector_base + 16, "SYSRET needs user code after user data");
@@ -0,0 +1,121 @@
+#include <cstring>
+
+#include "acpi.hpp"
+#include "apic.hpp"
+#include "arch.hpp"
+#include "cpu_local.hpp"
+#include "pit.hpp"
+#include "smp.hpp"
+#include "util.hpp"
+#include "x86.hpp"
+
+extern "C" char ap_trampoline_start[];
+extern "C" char ap_trampoline_end[];
+extern "C" char ap_trampoline_stack[];
+extern "C" [[noreturn]] void ap_entry();
+
+static size_t cpu_count = 1;
+
+// Where APs continue once they are all up.
+static void (*ap_main)();
+
+static bool ap_online;
+static bool ap_release;
+
+size_t get_cpu_count()
+{
+  return cpu_count;
+}
+
+// The boot CPU runs on the stack from start.asm. Everyone else runs on the
+// stack in its local area. So we find out which CPU we are by looking at our
+// stack pointer.
+size_t get_cpu_index()
+{
+  uintptr_t sp;
+  asm ("mov %%rsp, %0" : "=r" (sp));
+
+  uintptr_t const offset = sp - cpu_local_window;
+  return offset < max_cpus * large_page_size ? offset / large_page_size : 0;
+}
+
+void ap_entry()
+{
+  setup_application_processor();
+
+  __atomic_store_n(&ap_online, true, __ATOMIC_RELEASE);
+
+  while (not __atomic_load_n(&ap_release, __ATOMIC_ACQUIRE))
+    pause();
+
+  ap_main();
+  wait_forever();
+}
+
+// Start the AP with the given APIC ID as the next CPU. Its local area comes
+// from its own NUMA node. Returns false, if it doesn't show up.
+static bool boot_ap(uint32_t apic_id)
+{
+  auto &area = setup_cpu_local_area(cpu_count, apic_id);
+  uintptr_t const stack_top = reinterpret_cast<uintptr_t>(area.stack + sizeof(area.stack));
+  auto const trampoline_stack = reinterpret_cast<uint64_t *>(ap_trampoline_base + (ap_trampoline_stack - ap_trampoline_start));
+
+  *trampoline_stack = stack_top;
+  __atomic_store_n(&ap_online, false, __ATOMIC_RELEASE);
+
+  // The universal startup algorithm. See Intel SDM Vol. 3 Chapter 8.4.4.1.
+  send_init_ipi(apic_id);
+  udelay(10000);
+
+  for (int i = 0; i < 2; i++) {
+    send_startup_ipi(apic_id, ap_trampoline_base >> 12);
+    udelay(200);
+
+    if (__atomic_load_n(&ap_online, __ATOMIC_ACQUIRE))
+      return true;
+  }
+
+  for (int i = 0; i < 1000; i++) {
+    if (__atomic_load_n(&ap_online, __ATOMIC_ACQUIRE))
+      return true;
+
+    udelay(100);
+  }
+
+  return false;
+}
+
+void start_application_processors(size_t limit, void (*entry)())
+{
+  uint32_t apic_ids[max_cpus];
+  size_t const apic_id_count = get_madt_apic_ids(apic_ids, array_size(apic_ids));
+  uint32_t const my_apic_id = get_lapic_id();
+
+  if (limit == 0 or limit > max_cpus)
+    limit = max_cpus;
+
+  assert((size_t)(ap_trampoline_end - ap_trampoline_start) <= page_size,
+         "AP trampoline doesn't fit into its page");
+  memcpy(reinterpret_cast<void *>(ap_trampoline_base), ap_trampoline_start,
+         ap_trampoline_end - ap_trampoline_start);
+
+  ap_main = entry;
+
+  for (size_t i = 0; i < apic_id_count and cpu_count < limit; i++) {
+    if (apic_ids[i] == my_apic_id)
+      continue;
+
+    if (not boot_ap(apic_ids[i])) {
+      // The AP might still come up later and would then use the local area we
+      // hand to the next one. So stop here.
+      format(">>> CPU with APIC ID ", apic_ids[i], " didn't start. Not starting any more CPUs.\n");
+      break;
+    }
+
+    cpu_count++;
+  }
+
+  format(">>> Running on ", cpu_count, " CPU", cpu_count == 1 ? "" : "s", ".\n");
+
+  __atomic_store_n(&ap_release, true, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstdint>
+
+// APs start in real mode, so the trampoline has to live below 1MB. It takes up
+// one page. Keep this in sync with trampoline.asm.
+const uintptr_t ap_trampoline_base = 0x8000;
+
+// Prepare the current application processor to execute user code the same way
+// as the boot CPU. See arch.cpp.
+void setup_application_processor();
@@ -27,9 +27,9 @@
 
 bits 32
 
-extern start, _image_start, wait_forever, execute_constructors, setup_arch
+extern start, wait_forever, execute_constructors, setup_arch
 extern boot_pml4, boot_pdpt, boot_pd
-global _start, kern_stack
+global _start, kern_stack, multiboot_info
 
 section .bss
   kern_stack resb 4 * PAGE_SIZE
@@ -37,6 +37,9 @@ kern_stack_end:
 
   cmdline resb MAX_CMDLINE_SIZE
 
+  ; The physical address of the multiboot information structure.
+  multiboot_info resd 1
+
 section .text._start
 _mbheader:
 align 4
@@ -62,6 +65,8 @@ _boot_gdt_end:
 %define RING0_DATA_SELECTOR 0x20
 
 _start:
+  mov dword [multiboot_info], ebx
+
   ; Is there a command line? If not, we keep the empty string as command line.
   test dword [ebx], 0x04
   jz no_cmdline
@@ -95,12 +100,16 @@ no_cmdline:
   or eax, PTE_P | PTE_W
   mov dword [boot_pdpt], eax
 
-  ; Fill out PDE
-  mov eax, _image_start
-  mov ebx, eax
-  shr ebx, 18
-  or eax, PTE_P | PTE_W | PTE_PS
-  mov dword [boot_pd + ebx], eax
+  ; Identity map the first GB with large pages. This covers our image, the
+  ; BIOS data areas and the AP trampoline.
+  mov eax, PTE_P | PTE_W | PTE_PS
+  xor ebx, ebx
+fill_pd:
+  mov dword [boot_pd + ebx * 8], eax
+  add eax, 1 << 21
+  inc ebx
+  cmp ebx, 512
+  jne fill_pd
 
   ; Load page table
   mov eax, boot_pml4
@@ -0,0 +1,114 @@
+  ; -*- Mode: nasm -*-
+
+  ; Application processors start in real mode at a page below 1MB. The code
+  ; between ap_trampoline_start and ap_trampoline_end is copied to
+  ; TRAMPOLINE_BASE and switches to long mode the same way as start.asm.
+
+%define TRAMPOLINE_BASE 0x8000  ; Keep in sync with smp.hpp
+
+%define IA32_EFER 0xC0000080
+%define IA32_EFER_LME 0x100
+%define IA32_EFER_NXE 0x800
+
+%define CR4_PAE (1 << 5)
+%define CR4_OSFXSR (1 << 9)
+%define CR4_OSXSAVE (1 << 18)
+%define CR4_SMEP (1 << 20)
+%define CR0_PE (1 << 0)
+%define CR0_MP (1 << 1)
+%define CR0_WP (1 << 16)
+%define CR0_PG (1 << 31)
+
+%define XCR0_X87 (1 << 0)
+%define XCR0_SSE (1 << 1)
+
+  ; The selectors match the boot GDT and the GDT we load later, except for the
+  ; 32-bit code segment.
+%define RING0_CODE32_SELECTOR 0x08
+%define RING0_CODE_SELECTOR 0x10
+%define RING0_DATA_SELECTOR 0x20
+
+  ; The address of a trampoline symbol after it has been copied.
+%define TR(sym) (TRAMPOLINE_BASE + (sym) - ap_trampoline_start)
+
+extern boot_pml4, ap_entry
+global ap_trampoline_start, ap_trampoline_end, ap_trampoline_stack
+
+section .text
+
+bits 16
+ap_trampoline_start:
+  ; The STARTUP IPI leaves us at CS:IP = TRAMPOLINE_BASE >> 4:0.
+  cli
+  xor ax, ax
+  mov ds, ax
+
+  o32 lgdt [TR(trampoline_gdtr)]
+
+  mov eax, CR0_PE
+  mov cr0, eax
+  jmp dword RING0_CODE32_SELECTOR:TR(trampoline_32)
+
+bits 32
+trampoline_32:
+  mov eax, RING0_DATA_SELECTOR
+  mov ss, eax
+  mov ds, eax
+  mov es, eax
+
+  mov eax, boot_pml4
+  mov cr3, eax
+
+  ; See start.asm for the meaning of all of this.
+  mov eax, CR4_PAE | CR4_SMEP | CR4_OSFXSR | CR4_OSXSAVE
+  mov cr4, eax
+
+  mov eax, XCR0_X87 | XCR0_SSE
+  xor edx, edx
+  xor ecx, ecx
+  xsetbv
+
+  xor edx, edx
+  mov eax, IA32_EFER_LME | IA32_EFER_NXE
+  mov ecx, IA32_EFER
+  wrmsr
+
+  mov eax, CR0_PE | CR0_MP | CR0_WP | CR0_PG
+  mov cr0, eax
+
+  jmp RING0_CODE_SELECTOR:ap_start_long
+
+align 8
+trampoline_gdt:
+  dq 0
+  dq 0x00cf9a000000ffff         ; 32-bit code
+  dq 0x00a09b0000000000         ; 64-bit code
+  dq 0
+  dq 0x00cf93000000ffff         ; Data
+trampoline_gdt_end:
+
+trampoline_gdtr:
+  dw trampoline_gdt_end - trampoline_gdt - 1
+  dd TR(trampoline_gdt)
+
+  ; The boot CPU stores the initial stack pointer for the next AP here.
+align 8
+ap_trampoline_stack:
+  dq 0
+ap_trampoline_end:
+
+bits 64
+ap_start_long:
+  mov eax, RING0_DATA_SELECTOR
+  mov ss, eax
+  mov ds, eax
+  mov es, eax
+  mov fs, eax
+  mov gs, eax
+
+  mov rsp, [TR(ap_trampoline_stack)]
+  cld
+  call ap_entry
+
+  ; ap_entry doesn't return.
+  ud2